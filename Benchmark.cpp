@@ -0,0 +1,264 @@
+#include "Generator.h"
+
+#include <iomanip>
+#include <sys/wait.h>
+
+// Benchmarks for the core storage operations.
+//
+//   hms_bench [max records] [ops per measurement]
+//
+// Runs at 10^3, 10^4, ... up to max records (default 10^6; pass 10000000
+// for the full range). Each size gets a fresh scratch directory holding
+// that many doctors and as many appointments from DatasetGenerator (seeded
+// with the size, default skew and tombstone ratios), and runs in its own
+// child process: the data files are
+// opened by relative path, so every size needs its own working directory
+// and its own RecordFile registry. Results are ops/sec and latency
+// percentiles in microseconds, one line per operation. The "query batch"
+// lines run a mix of all three queries through QueryManager::executeBatch
+// on 1, 2, 4, ... threads up to the core count (throughput only).
+
+// Swallows the console output of the commands being measured
+struct NullBuffer : streambuf
+{
+    int overflow(int c) override { return c; }
+};
+
+struct Result
+{
+    string operation;
+    vector<double> micros;
+    long batched = 0;           // operations timed only as a whole
+    double seconds = 0;
+    long failed = 0;
+};
+
+static double percentile(vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void report(long records, Result& r)
+{
+    sort(r.micros.begin(), r.micros.end());
+    long count = r.batched > 0 ? r.batched : (long)r.micros.size();
+    double opsPerSec = r.seconds > 0 ? count / r.seconds : 0;
+    cout << setw(9) << records << "  " << left << setw(20) << r.operation << right
+         << fixed << setprecision(0) << setw(11) << opsPerSec
+         << setprecision(1);
+    if (r.batched > 0)
+        cout << setw(10) << "-" << setw(10) << "-" << setw(10) << "-" << setw(10) << "-" << setw(11) << "-";
+    else
+        cout << setw(10) << percentile(r.micros, 0.50)
+             << setw(10) << percentile(r.micros, 0.90)
+             << setw(10) << percentile(r.micros, 0.99)
+             << setw(10) << percentile(r.micros, 0.999)
+             << setw(11) << (r.micros.empty() ? 0 : r.micros.back());
+    if (r.failed > 0)
+        cout << "  (" << r.failed << " failed)";
+    cout << "\n" << flush;
+}
+
+// Time `count` calls of op(i) under the database lock, as the command loop
+// runs them
+template <class F>
+static Result measure(Database& db, const string& name, long count, F op)
+{
+    Result r;
+    r.operation = name;
+    r.micros.reserve(count);
+
+    NullBuffer null;
+    streambuf* saved = cout.rdbuf(&null);
+    auto begin = chrono::steady_clock::now();
+    for (long i = 0; i < count; ++i)
+    {
+        auto start = chrono::steady_clock::now();
+        bool ok;
+        {
+            TableLocks hold = db.exclusive();
+            ok = op(i);
+        }
+        r.micros.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        if (!ok) r.failed++;
+    }
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    cout.rdbuf(saved);
+    return r;
+}
+
+// Throughput of one QueryManager batch on `threads` workers, each query
+// under shared table locks
+static Result measureBatch(Database& db, const string& name, const vector<string>& queries, unsigned threads)
+{
+    Result r;
+    r.operation = name;
+    r.batched = (long)queries.size();
+
+    QueryManager qm;
+    auto begin = chrono::steady_clock::now();
+    vector<pair<bool, string>> results = qm.executeBatch(queries, db, threads);
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    for (const auto& result : results)
+        if (!result.first) r.failed++;
+    return r;
+}
+
+// IDs of the records that are not tombstones
+static vector<string> liveIDs(PrimaryIndex& index, long count)
+{
+    vector<string> ids;
+    for (long i = 1; i <= count; ++i)
+    {
+        string id = IdSequence::formatID(i);
+        if (index.isLive(id))
+            ids.push_back(id);
+    }
+    return ids;
+}
+
+static void runSize(long records, long ops)
+{
+    DatasetSpec spec;
+    spec.doctors = records;
+    spec.appointments = records;
+    spec.seed = records;
+
+    NullBuffer null;
+    streambuf* saved = cout.rdbuf(&null);
+    bool generated = DatasetGenerator(spec).generate();
+    Database db("AppointmentsIndexfile.idx", "DocIndexFile.idx");
+    if (generated)
+        db.open();
+    cout.rdbuf(saved);
+    if (!generated)
+        _exit(1);
+
+    mt19937_64 rng(records);
+    uniform_int_distribution<long> anyID(1, records);
+    vector<string> doctors = liveIDs(db.doctorIndex, records);
+    vector<string> appointments = liveIDs(db.appIndex, records);
+    uniform_int_distribution<size_t> anyDoctor(0, doctors.size() - 1);
+    shuffle(appointments.begin(), appointments.end(), rng);
+
+    Insert ins(db);
+    UpdateManager um(db);
+    DeleteManager dm(db);
+    QueryManager qm;
+
+    // Mutations commit (and sync) one log transaction each
+    long writes = min(ops, (long)appointments.size());
+
+    vector<Result> results;
+
+    results.push_back(measure(db, "indexByID", ops * 10, [&](long) {
+        return db.doctorIndex.indexByID(IdSequence::formatID(anyID(rng))) != -1;
+    }));
+
+    results.push_back(measure(db, "insertDoctor", writes, [&](long i) {
+        return ins.insertDoctor("New Doctor " + to_string(i), "New Street", db.doctorIndex, db.secName);
+    }));
+
+    results.push_back(measure(db, "insertAppointment", writes, [&](long) {
+        return ins.insertAppointment("01 feb", doctors[anyDoctor(rng)], db.appIndex, db.secID);
+    }));
+
+    results.push_back(measure(db, "updateDoctorName", writes, [&](long i) {
+        return um.updateDoctorName(db.doctorIndex, db.secName, doctors[anyDoctor(rng)],
+                                   "Renamed " + to_string(i));
+    }));
+
+    // Distinct live IDs, so no delete hits an already deleted record
+    results.push_back(measure(db, "deleteAppointment", writes, [&](long i) {
+        return dm.deleteAppointment(db.appIndex, db.secID, appointments[i]);
+    }));
+
+    results.push_back(measure(db, "query doctor by id", ops, [&](long) {
+        return qm.executeQuery("Select all from Doctors where Doctor ID='" + IdSequence::formatID(anyID(rng)) + "';",
+                               db.doctorIndex, db.appIndex, db.secID, db.secName);
+    }));
+
+    results.push_back(measure(db, "query appts by doc", ops, [&](long) {
+        return qm.executeQuery("Select all from Appointments where Doctor ID='" + IdSequence::formatID(anyID(rng)) + "';",
+                               db.doctorIndex, db.appIndex, db.secID, db.secName);
+    }));
+
+    results.push_back(measure(db, "query doctor name", ops, [&](long) {
+        return qm.executeQuery("Select Doctor Name from Doctors where Doctor Name='" +
+                               DatasetGenerator::doctorName(anyID(rng) - 1) + "';",
+                               db.doctorIndex, db.appIndex, db.secID, db.secName);
+    }));
+
+    // The three queries above, mixed, as one batch on 1..all cores
+    vector<string> batch;
+    for (long i = 0; i < ops * 10; ++i)
+    {
+        string id = IdSequence::formatID(anyID(rng));
+        if (i % 3 == 0)
+            batch.push_back("Select all from Doctors where Doctor ID='" + id + "';");
+        else if (i % 3 == 1)
+            batch.push_back("Select all from Appointments where Doctor ID='" + id + "';");
+        else
+            batch.push_back("Select Doctor Name from Doctors where Doctor Name='" +
+                            DatasetGenerator::doctorName(anyID(rng) - 1) + "';");
+    }
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < cores; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(cores);
+    for (unsigned threads : threadCounts)
+        results.push_back(measureBatch(db, "query batch x" + to_string(threads), batch, threads));
+
+    saved = cout.rdbuf(&null);
+    db.close();
+    cout.rdbuf(saved);
+
+    for (Result& r : results)
+        report(records, r);
+}
+
+int main(int argc, char* argv[])
+{
+    long maxRecords = argc > 1 ? atol(argv[1]) : 1000000;
+    long ops = argc > 2 ? atol(argv[2]) : 1000;
+    if (maxRecords < 1000 || ops < 1)
+    {
+        cout << "usage: hms_bench [max records >= 1000] [ops per measurement]\n";
+        return 1;
+    }
+
+    filesystem::path root = filesystem::temp_directory_path() / ("hms_bench_" + to_string(getpid()));
+    filesystem::create_directories(root);
+
+    cout << "  records  operation               ops/sec   p50 us    p90 us    p99 us  p99.9 us     max us\n";
+    bool ok = true;
+    for (long records = 1000; records <= maxRecords; records *= 10)
+    {
+        filesystem::path dir = root / to_string(records);
+        filesystem::create_directories(dir);
+
+        cout << flush;
+        pid_t child = fork();
+        if (child == 0)
+        {
+            filesystem::current_path(dir);
+            runSize(records, ops);
+            _exit(0);
+        }
+
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            cout << "Benchmark at " << records << " records failed.\n";
+            ok = false;
+        }
+        filesystem::remove_all(dir);
+    }
+
+    filesystem::remove_all(root);
+    return ok ? 0 : 1;
+}
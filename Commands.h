@@ -0,0 +1,1338 @@
+// Commands on top of the storage layer: inserts, updates, deletes, lookups,
+// queries, the bulk loader and the batch runner.
+#pragma once
+
+#include "Storage.h"
+
+class Insert
+{
+private:
+    FreeSpaceManager& doctorsSpace;
+    FreeSpaceManager& appointmentsSpace;
+    IdSequence& doctorIds;
+    IdSequence& appointmentIds;
+    // Used to validate the doctor an appointment refers to
+    PrimaryIndex& doctorsIndex;
+    WriteAheadLog& wal;
+
+    // -------------------------
+    //  Utility Functions
+    // -------------------------
+
+    string readOldIDAtOffset(const string& filename, long offset)
+    {
+        string line;
+        if (!RecordFile::get(filename).readLine(offset, line)) return "00";
+
+        size_t p1 = line.find('|');
+        size_t p2 = line.find('|', p1 + 1);
+
+        if (p1 == string::npos || p2 == string::npos) return "00";
+
+        return line.substr(p1 + 1, p2 - p1 - 1);
+    }
+
+public:
+
+    // Record layout shared with the dataset generator
+    static string formatLength(int len)
+    {
+        string s = to_string(len);
+        if (s.length() < 3)
+            s = string(3 - s.length(), '0') + s;
+        return s;
+    }
+
+    static string buildDoctorRecord(const string& id, const string& name,
+                                    const string& address, int totalLen = -1)
+    {
+        string tail = " |" + id + "|" + name + "|" + address;
+        int currentTotal = 3 + tail.length();
+
+        if (totalLen != -1 && totalLen > currentTotal)
+        {
+            int pad = totalLen - currentTotal;
+            tail += string(pad, ' ');
+        }
+
+        return formatLength(tail.length()) + tail;
+    }
+
+    static string buildAppointmentRecord(const string& appID,
+                                         const string& date, const string& doctorID,
+                                         int totalLen = -1)
+    {
+        string tail = " |" + appID + "|" + date + "|" + doctorID;
+        int currentTotal = 3 + tail.length();
+
+        if (totalLen != -1 && totalLen > currentTotal)
+        {
+            int pad = totalLen - currentTotal;
+            tail += string(pad, ' ');
+        }
+
+        return formatLength(tail.length()) + tail;
+    }
+
+    explicit Insert(Database& db)
+            : doctorsSpace(db.doctorsSpace), appointmentsSpace(db.appointmentsSpace),
+              doctorIds(db.doctorIds), appointmentIds(db.appointmentIds),
+              doctorsIndex(db.doctorIndex), wal(db.wal) {
+    }
+
+    // ---------------------------------------------------
+    //                 INSERT DOCTOR
+    // ---------------------------------------------------
+    bool insertDoctor(const string& name,
+                      const string& address,
+                      PrimaryIndex& doctorIndex,
+                      SecondaryIndexDoctorName& secName,
+                      ostream& out = cout)
+    {
+        Stats::Timer timer(Stats::InsertDoctor);
+        if (secName.nameExists(name))
+        {
+            out << "Error: Doctor name already exists.\n";
+            return false;
+        }
+
+        const string dataFile = "doctors.txt";
+        FreeSpaceManager& space = doctorsSpace;
+
+        string dummyID = "00";
+        string dummyTail = " |" + dummyID + "|" + name + "|" + address;
+        int minLen = 3 + dummyTail.length();
+
+        long off = -1;
+        int slotLen = -1;
+
+        // The data-file writes below, including the ones allocate()/restore()
+        // make, go to the log as one transaction
+        wal.begin();
+        bool foundSlot = space.allocate(minLen, off, slotLen);
+
+        string finalID;
+        string record;
+        long writeOffset;
+
+        if (foundSlot)
+        {
+            // A slot keeps the ID of the record deleted from it
+            finalID = readOldIDAtOffset(dataFile, off);
+            if (finalID.empty())
+                finalID = doctorIds.next(doctorIndex);
+
+            record = buildDoctorRecord(finalID, name, address, slotLen);
+
+            // minLen assumed a 2-digit ID; a longer inherited one may not fit
+            if ((int)record.length() > slotLen)
+            {
+                space.restore(off, slotLen);
+                foundSlot = false;
+            }
+        }
+
+        if (foundSlot)
+        {
+            writeOffset = off;
+            wal.write(dataFile, writeOffset, record);
+        }
+        else
+        {
+            finalID = doctorIds.next(doctorIndex);
+
+            record = buildDoctorRecord(finalID, name, address);
+
+            writeOffset = wal.append(dataFile, record + "\n");
+        }
+
+        // Index changes land in their delta logs inside the same transaction
+        doctorIndex.upsert(finalID, writeOffset);
+        secName.addEntry(name, writeOffset);
+        wal.commit();
+
+        out << "Doctor inserted with ID: " << finalID << "\n";
+        return true;
+    }
+
+    // ---------------------------------------------------
+    //              INSERT APPOINTMENT
+    // ---------------------------------------------------
+    bool insertAppointment(const string& date,
+                           const string& doctorID,
+                           PrimaryIndex& appIndex,
+                           SecondaryIndexDoctorID& secID,
+                           ostream& out = cout)
+    {
+        Stats::Timer timer(Stats::InsertAppointment);
+        if (!doctorsIndex.isLive(doctorID))
+        {
+            out << "Error: Doctor ID does not exist or deleted.\n";
+            return false;
+        }
+
+        const string dataFile = "appointments.txt";
+        FreeSpaceManager& space = appointmentsSpace;
+
+        string dummyID = "00";
+        string dummyTail = " |" + dummyID + "|" + date + "|" + doctorID;
+        int minLen = 3 + dummyTail.length();
+
+        long off = -1;
+        int slotLen = -1;
+
+        // The data-file writes below, including the ones allocate()/restore()
+        // make, go to the log as one transaction
+        wal.begin();
+        bool foundSlot = space.allocate(minLen, off, slotLen);
+
+        string finalID;
+        string record;
+        long writeOffset;
+
+        if (foundSlot)
+        {
+            // A slot keeps the ID of the record deleted from it
+            finalID = readOldIDAtOffset(dataFile, off);
+            if (finalID.empty())
+                finalID = appointmentIds.next(appIndex);
+
+            record = buildAppointmentRecord(finalID, date, doctorID, slotLen);
+
+            // minLen assumed a 2-digit ID; a longer inherited one may not fit
+            if ((int)record.length() > slotLen)
+            {
+                space.restore(off, slotLen);
+                foundSlot = false;
+            }
+        }
+
+        if (foundSlot)
+        {
+            writeOffset = off;
+            wal.write(dataFile, writeOffset, record);
+        }
+        else
+        {
+            finalID = appointmentIds.next(appIndex);
+
+            record = buildAppointmentRecord(finalID, date, doctorID);
+
+            writeOffset = wal.append(dataFile, record + "\n");
+        }
+
+        appIndex.upsert(finalID, writeOffset);
+        secID.addEntry(doctorID, finalID, writeOffset);
+        wal.commit();
+
+        out << "Appointment inserted with ID: " << finalID << "\n";
+        return true;
+    }
+};
+
+
+
+
+//
+//
+//
+// Add Update Class here
+//
+//
+//
+//
+//
+
+
+// ====================== UPDATE MANAGER CLASS ======================
+
+
+// Loads a CSV of doctors and appointments straight into the data files.
+// Lines are "doctor,<name>,<address>" or "appointment,<date>,<doctor id>"
+// (fields may be double-quoted). Records are appended through one large
+// buffer, IDs come from the sequences without per-record probes, and the
+// indexes are sorted and written once at the end instead of per record.
+// Holes in the avail lists are left for the interactive inserts to reuse.
+// The appends bypass the log, so the whole import runs under exclusive():
+// no checkpoint saves the indexes halfway through, and the data files are
+// synced before any snapshot that points into them.
+class BulkLoader
+{
+private:
+    static const size_t FlushBytes = 4 << 20;
+
+    Database& db;
+
+    // Appends records to one data file, tracking the offset of each
+    struct Appender
+    {
+        ofstream out;
+        string buffer;
+        long offset = 0;
+
+        bool open(const string& file)
+        {
+            error_code ec;
+            offset = (long)filesystem::file_size(file, ec);
+            if (ec) offset = 0;
+
+            out.open(file, ios::binary | ios::app);
+            if (!out) return false;
+
+            // Older files may end without a line terminator
+            if (offset > 0 && RecordFile::get(file).byteAt(offset - 1) != '\n')
+            {
+                buffer += '\n';
+                offset++;
+            }
+            return true;
+        }
+
+        long append(const string& record)
+        {
+            long at = offset;
+            buffer += record;
+            buffer += '\n';
+            offset += record.size() + 1;
+            if (buffer.size() >= FlushBytes)
+                flush();
+            return at;
+        }
+
+        bool flush()
+        {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+            return (bool)out;
+        }
+    };
+
+    static string formatLength(int len)
+    {
+        string s = to_string(len);
+        if (s.length() < 3)
+            s = string(3 - s.length(), '0') + s;
+        return s;
+    }
+
+    // "NNN |id|a|b", or empty if it can't be stored in this format
+    static string buildRecord(const string& id, const string& a, const string& b)
+    {
+        if (a.find('|') != string::npos || b.find('|') != string::npos)
+            return "";
+        string tail = " |" + id + "|" + a + "|" + b;
+        if (tail.length() > 999)
+            return "";
+        return formatLength(tail.length()) + tail;
+    }
+
+    // Split one CSV line; handles quoted fields and "" inside quotes
+    static vector<string> splitCsv(const string& line)
+    {
+        vector<string> fields(1);
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            char c = line[i];
+            if (quoted)
+            {
+                if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+                    fields.back() += line[++i];
+                else if (c == '"')
+                    quoted = false;
+                else
+                    fields.back() += c;
+            }
+            else if (c == '"')
+                quoted = true;
+            else if (c == ',')
+                fields.emplace_back();
+            else if (c != '\r')
+                fields.back() += c;
+        }
+        for (string& f : fields)
+        {
+            size_t start = f.find_first_not_of(' ');
+            size_t end = f.find_last_not_of(' ');
+            f = (start == string::npos) ? "" : f.substr(start, end - start + 1);
+        }
+        return fields;
+    }
+
+public:
+    explicit BulkLoader(Database& database) : db(database) {}
+
+    bool import(const string& csvFile)
+    {
+        ifstream in(csvFile);
+        if (!in)
+        {
+            cout << "Error: Cannot open " << csvFile << "!\n";
+            return false;
+        }
+
+        TableLocks hold = db.exclusive();
+
+        Appender doctors, appointments;
+        if (!doctors.open("doctors.txt") || !appointments.open("appointments.txt"))
+        {
+            cout << "Error opening data files!\n";
+            return false;
+        }
+
+        auto started = chrono::steady_clock::now();
+
+        db.doctorIds.skipPast(db.doctorIndex);
+        db.appointmentIds.skipPast(db.appIndex);
+
+        // Names taken by doctors earlier in this same file
+        unordered_set<string> batchNames;
+
+        long doctorCount = 0, appointmentCount = 0, rejected = 0, lineNo = 0;
+        string line;
+
+        while (getline(in, line))
+        {
+            lineNo++;
+            vector<string> f = splitCsv(line);
+            if (f.size() == 1 && f[0].empty())
+                continue;
+
+            string kind = f[0];
+            transform(kind.begin(), kind.end(), kind.begin(), ::tolower);
+
+            if ((kind == "doctor" || kind == "d") && f.size() == 3)
+            {
+                string key = SecondaryIndexDoctorName::normalizeName(f[1]);
+                if (key.empty() || db.secName.nameExists(f[1]) || !batchNames.insert(key).second)
+                {
+                    cout << "Line " << lineNo << ": doctor name missing or already exists, skipped.\n";
+                    rejected++;
+                    continue;
+                }
+
+                // A rejected line doesn't use up an ID
+                string id = db.doctorIds.peek();
+                string record = buildRecord(id, f[1], f[2]);
+                if (record.empty())
+                {
+                    cout << "Line " << lineNo << ": doctor record too long or contains '|', skipped.\n";
+                    rejected++;
+                    continue;
+                }
+                db.doctorIds.take();
+
+                db.doctorIndex.addToIndex(id, doctors.append(record));
+                doctorCount++;
+            }
+            else if ((kind == "appointment" || kind == "a") && f.size() == 3)
+            {
+                if (!db.doctorIndex.isLive(f[2]))
+                {
+                    cout << "Line " << lineNo << ": doctor " << f[2] << " does not exist, skipped.\n";
+                    rejected++;
+                    continue;
+                }
+
+                // A rejected line doesn't use up an ID
+                string id = db.appointmentIds.peek();
+                string record = buildRecord(id, f[1], f[2]);
+                if (record.empty())
+                {
+                    cout << "Line " << lineNo << ": appointment record too long or contains '|', skipped.\n";
+                    rejected++;
+                    continue;
+                }
+                db.appointmentIds.take();
+
+                db.appIndex.addToIndex(id, appointments.append(record));
+                appointmentCount++;
+            }
+            else if (lineNo > 1)
+            {
+                // The first line may be a header
+                cout << "Line " << lineNo << ": unrecognised, skipped.\n";
+                rejected++;
+            }
+        }
+
+        bool ok = doctors.flush() && appointments.flush();
+        doctors.out.close();
+        appointments.out.close();
+        ok = syncPath("doctors.txt") && syncPath("appointments.txt") && ok;
+        if (!ok)
+            cout << "Error writing data files!\n";
+
+        db.doctorIds.save();
+        db.appointmentIds.save();
+
+        // One sort per index
+        db.doctorIndex.saveIndex();
+        db.appIndex.saveIndex();
+        db.secName.createIndex();
+        db.secID.createIndex();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        long total = doctorCount + appointmentCount;
+
+        cout << "Imported " << doctorCount << " doctors and " << appointmentCount
+             << " appointments (" << rejected << " lines skipped) in " << seconds << " s";
+        if (seconds > 0)
+            cout << ", " << (long)(total / seconds) << " records/sec";
+        cout << ".\n";
+        return ok;
+    }
+};
+class UpdateManager {
+private:
+    WriteAheadLog& wal;
+
+    // Format ID to 2 digits (01, 02, etc.)
+    string formatID(const string& id) {
+        if (id.length() == 1) return "0" + id;
+        return id;
+    }
+
+    // Format length to 3 digits for record header
+    string formatLength(int len) {
+        string s = to_string(len);
+        if (s.length() < 3)
+            s = string(3 - s.length(), '0') + s;
+        return s;
+    }
+
+    // Enforce field size limits [15], [30] as per assignment
+    string enforceFieldSize(const string& field, int maxSize) {
+        if (field.length() > maxSize) {
+            return field.substr(0, maxSize);
+        }
+        return field;
+    }
+
+    // Build doctor record with proper format and field sizes
+    string buildDoctorRecord(const string& id, const string& name, const string& address) {
+        // Enforce assignment field sizes
+        string enforcedID = enforceFieldSize(id, 15);
+        string enforcedName = enforceFieldSize(name, 30);
+        string enforcedAddress = enforceFieldSize(address, 30);
+
+        string tail = " |" + enforcedID + "|" + enforcedName + "|" + enforcedAddress;
+        return formatLength(tail.length()) + tail;
+    }
+
+    // Build appointment record with proper format and field sizes
+    string buildAppointmentRecord(const string& appID, const string& date, const string& doctorID) {
+        // Enforce assignment field sizes
+        string enforcedAppID = enforceFieldSize(appID, 15);
+        string enforcedDate = enforceFieldSize(date, 30);
+        string enforcedDoctorID = enforceFieldSize(doctorID, 15);
+
+        string tail = " |" + enforcedAppID + "|" + enforcedDate + "|" + enforcedDoctorID;
+        return formatLength(tail.length()) + tail;
+    }
+
+public:
+    explicit UpdateManager(Database& db) : wal(db.wal) {}
+
+    // CORRECTED: Update doctor name with guaranteed duplicate checking
+    bool updateDoctorName(PrimaryIndex& doctorIndex, SecondaryIndexDoctorName& secName,
+                          const string& doctorID, const string& newName, ostream& out = cout) {
+        Stats::Timer timer(Stats::UpdateDoctor);
+
+        // Input validation
+        if (doctorID.empty() || newName.empty()) {
+            out << "Error: Doctor ID and name cannot be empty.\n";
+            return false;
+        }
+
+        string formattedID = formatID(doctorID);
+
+        // Check if doctor exists
+        long offset = doctorIndex.indexByID(formattedID);
+        if (offset == -1) {
+            out << "Error: Doctor ID " << formattedID << " not found.\n";
+            return false;
+        }
+
+        // Read and validate current record
+        string record(doctorIndex.readRecordAtOffset(offset));
+        if (record.empty()) {
+            out << "Error: Cannot read doctor record.\n";
+            return false;
+        }
+
+        // Prevent updates to deleted records
+        if (record[3] == '*') {
+            out << "Error: Cannot update deleted doctor record.\n";
+            return false;
+        }
+
+        // Duplicate check against the name index, ignoring this doctor
+        if (secName.nameExists(enforceFieldSize(newName, 30), offset)) {
+            out << "Error: Doctor name '" << newName << "' already exists in the system.\n";
+            return false;
+        }
+
+        // Parse record to extract fields
+        size_t firstPipe = record.find('|');
+        size_t secondPipe = record.find('|', firstPipe + 1);
+        size_t thirdPipe = record.find('|', secondPipe + 1);
+
+        if (firstPipe == string::npos || secondPipe == string::npos || thirdPipe == string::npos) {
+            out << "Error: Invalid doctor record format.\n";
+            return false;
+        }
+
+        // Extract current fields (update non-key fields only)
+        string currentID = record.substr(firstPipe + 1, secondPipe - firstPipe - 1);
+        string currentName = record.substr(secondPipe + 1, thirdPipe - secondPipe - 1);
+        string currentAddress = record.substr(thirdPipe + 1);
+
+        // Build updated record with proper length indicator
+        string updatedRecord = buildDoctorRecord(currentID, newName, currentAddress);
+
+        // Write updated record and the secondary index change as one
+        // transaction through the log
+        wal.begin();
+        wal.write("doctors.txt", offset, updatedRecord);
+        secName.updateEntry(currentName, enforceFieldSize(newName, 30), offset);
+        wal.commit();
+
+        out << "Doctor " << formattedID << " name updated successfully!\n";
+        return true;
+    }
+
+    // Update appointment date
+    bool updateAppointmentDate(PrimaryIndex& appIndex, const string& appointmentID, const string& newDate,
+                               ostream& out = cout) {
+        Stats::Timer timer(Stats::UpdateAppointment);
+
+        // Input validation
+        if (appointmentID.empty() || newDate.empty()) {
+            out << "Error: Appointment ID and date cannot be empty.\n";
+            return false;
+        }
+
+        string formattedID = formatID(appointmentID);
+
+        // Check if appointment exists
+        long offset = appIndex.indexByID(formattedID);
+        if (offset == -1) {
+            out << "Error: Appointment ID " << formattedID << " not found.\n";
+            return false;
+        }
+
+        // Read and validate current record
+        string record(appIndex.readRecordAtOffset(offset));
+        if (record.empty()) {
+            out << "Error: Cannot read appointment record.\n";
+            return false;
+        }
+
+        // Prevent updates to deleted records
+        if (record[3] == '*') {
+            out << "Error: Cannot update deleted appointment record.\n";
+            return false;
+        }
+
+        // Parse record to extract fields
+        size_t firstPipe = record.find('|');
+        size_t secondPipe = record.find('|', firstPipe + 1);
+        size_t thirdPipe = record.find('|', secondPipe + 1);
+
+        if (firstPipe == string::npos || secondPipe == string::npos || thirdPipe == string::npos) {
+            out << "Error: Invalid appointment record format.\n";
+            return false;
+        }
+
+        // Extract current fields (update non-key fields only)
+        string currentAppID = record.substr(firstPipe + 1, secondPipe - firstPipe - 1);
+        string currentDoctorID = record.substr(thirdPipe + 1);
+
+        // Build updated record with proper length indicator
+        string updatedRecord = buildAppointmentRecord(currentAppID, newDate, currentDoctorID);
+
+        // Write updated record to file (through the log)
+        wal.begin();
+        wal.write("appointments.txt", offset, updatedRecord);
+        wal.commit();
+
+        // Postings are keyed by doctor ID and offset, neither of which a
+        // date change touches, so the doctor ID index needs no maintenance.
+
+        out << "Appointment " << formattedID << " date updated successfully!\n";
+        return true;
+    }
+};
+class DeleteManager
+{
+private:
+    FreeSpaceManager& doctorsSpace;
+    FreeSpaceManager& appointmentsSpace;
+
+    WriteAheadLog& wal;
+
+    // Free the tombstoned record, merging it with neighbouring holes, and
+    // drop the IDs of records swallowed by the merge from the primary index
+    void releaseSlot(FreeSpaceManager& space, PrimaryIndex& index, long offset, int length)
+    {
+        vector<string> retired = space.release(offset, length);
+
+        for (const string& id : retired)
+            index.erase(id);
+    }
+
+public:
+
+    explicit DeleteManager(Database& db)
+            : doctorsSpace(db.doctorsSpace), appointmentsSpace(db.appointmentsSpace),
+              wal(db.wal) {
+    }
+    int getRecordLength(long offset, const string& filename)
+    {
+        string record;
+        if (!RecordFile::get(filename).readLine(offset, record))
+            return -1;
+
+        return record.length();
+    }
+
+    string readRecord(long offset, const string& filename)
+    {
+        return RecordFile::get(filename).readLine(offset);
+    }
+
+
+    bool deleteAppointment(PrimaryIndex& appIndex, SecondaryIndexDoctorID& secID, const string& appID,
+                           ostream& out = cout)
+    {
+        Stats::Timer timer(Stats::DeleteAppointment);
+        long offset = appIndex.indexByID(appID);
+        if (offset == -1)
+        {
+            out << "Warning: Appointment ID not found.\n";
+            return false;
+        }
+
+        RecordFile& data = RecordFile::get("appointments.txt");
+        if (!data.isOpen())
+        {
+            out << "Error opening appointments.txt\n";
+            return false;
+        }
+
+        if (data.byteAt(offset + 3) == '*')
+        {
+            out << "Warning: Appointment already deleted.\n";
+            return false;
+        }
+
+        // Keep the live copy so its postings can be dropped from secID
+        string record = readRecord(offset, "appointments.txt");
+
+        // Tombstone and hole bookkeeping commit together
+        wal.begin();
+        wal.write("appointments.txt", offset + 3, "*");
+        appIndex.markDeleted(appID);
+
+        int recSize = getRecordLength(offset, "appointments.txt");
+
+        if (recSize > 0)
+            releaseSlot(appointmentsSpace, appIndex, offset, recSize);
+
+        string oldAppID, doctorID;
+        if (SecondaryIndexDoctorID::parseRecord(record, oldAppID, doctorID))
+            secID.removeEntry(doctorID, offset);
+        wal.commit();
+
+        out << "Appointment " << appID << " deleted.\n";
+        return true;
+    }
+
+
+    bool deleteDoctor(PrimaryIndex& doctorIndex, SecondaryIndexDoctorName& secName, const string& docID,
+                      ostream& out = cout)
+    {
+        Stats::Timer timer(Stats::DeleteDoctor);
+        long offset = doctorIndex.indexByID(docID);
+        if (offset == -1)
+        {
+            out << "Warning: Doctor ID not found.\n";
+            return false;
+        }
+
+        RecordFile& data = RecordFile::get("doctors.txt");
+        if (!data.isOpen())
+        {
+            out << "Error opening doctors.txt\n";
+            return false;
+        }
+
+        if (data.byteAt(offset + 3) == '*')
+        {
+            out << "Warning: Appointment already deleted.\n";
+            return false;
+        }
+
+        string record = readRecord(offset, "doctors.txt");
+
+        // Tombstone and hole bookkeeping commit together
+        wal.begin();
+        wal.write("doctors.txt", offset + 3, "*");
+        doctorIndex.markDeleted(docID);
+
+        int recSize = getRecordLength(offset, "doctors.txt");
+
+        if (recSize > 0)
+            releaseSlot(doctorsSpace, doctorIndex, offset, recSize);
+
+        string name;
+        if (SecondaryIndexDoctorName::parseRecord(record, name))
+            secName.removeEntry(name, offset);
+        wal.commit();
+
+        out << "Doctor " << docID << " deleted.\n";
+        return true;
+    }
+
+    void printAvailLists()
+    {
+        cout << "\n--- Appointments Avail List (Variable-Length) ---\n";
+        if (appointmentsSpace.empty())
+        {
+            cout << "No deleted appointment records.\n";
+        }
+        else
+        {
+            for (auto slot : appointmentsSpace.slots())
+                cout << "Offset: " << slot.offset << " | Size: " << slot.length << endl;
+        }
+
+        cout << "\n--- Doctors Avail List (Variable-Length) ---\n";
+        if (doctorsSpace.empty())
+        {
+            cout << "No deleted doctor records.\n";
+        }
+        else
+        {
+            for (auto slot : doctorsSpace.slots())
+                cout << "Offset: " << slot.offset << " | Size: " << slot.length << endl;
+        }
+    }
+};
+
+
+class InfoManager
+{
+public:
+
+    bool printDoctorInfo(PrimaryIndex& docIndex, const string& doctorID, ostream& out = cout)
+    {
+        long offset = docIndex.indexByID(doctorID);
+
+        if (offset == -1)
+        {
+            out << "Doctor ID not found.\n";
+            return false;
+        }
+
+        RecordFile& file = RecordFile::get("doctors.txt");
+        if (!file.isOpen())
+        {
+            out << "Error opening doctors.txt\n";
+            return false;
+        }
+
+        auto cached = RecordCache::get().read("doctors.txt", offset);
+        string_view record = cached ? string_view(cached->line) : string_view();
+        if (record.size() > 3 && record[3] == '*')
+        {
+            out << "This record is deleted.\n";
+            return false;
+        }
+
+        out << "\n=== Doctor Info ===\n";
+        out << record << endl;
+        return true;
+    }
+
+
+    bool printAppointmentInfo(PrimaryIndex& appIndex, const string& appID, ostream& out = cout)
+    {
+        long offset = appIndex.indexByID(appID);
+
+        if (offset == -1)
+        {
+            out << "Appointment ID not found.\n";
+            return false;
+        }
+
+        RecordFile& file = RecordFile::get("appointments.txt");
+        if (!file.isOpen())
+        {
+            out << "Error opening appointments.txt\n";
+            return false;
+        }
+
+        auto cached = RecordCache::get().read("appointments.txt", offset);
+        string_view record = cached ? string_view(cached->line) : string_view();
+        if (record.size() > 3 && record[3] == '*')
+        {
+            out << "This record is deleted.\n";
+            return false;
+        }
+
+        out << "\n=== Appointment Info ===\n";
+        out << record << endl;
+        return true;
+    }
+};
+
+
+class QueryManager
+{
+public:
+
+    bool executeQuery(string query, PrimaryIndex& doctorPrimary, PrimaryIndex& appPrimary,
+                      SecondaryIndexDoctorID& secDocID, SecondaryIndexDoctorName& secDocName,
+                      ostream& out = cout
+    )
+    {
+        Stats::Timer timer(Stats::Query);
+        string q = toLower(query);
+
+        // Query 1: Select all from Doctors where Doctor ID='xxx';
+        if (q.find("select all from doctors") != string::npos &&
+            q.find("doctor id") != string::npos)
+        {
+            string id = getValueBetweenQuotes(query);
+            printDoctorByID(doctorPrimary, id, out);
+            return true;
+        }
+
+        // Query 2: Select all from Appointments where Doctor ID='xxx';
+        if (q.find("select all from appointments") != string::npos &&
+            q.find("doctor id") != string::npos)
+        {
+            string id = getValueBetweenQuotes(query);
+            printAppointmentByDoctorID(secDocID, id, out);
+            return true;
+        }
+
+        // Query 3: Select Doctor Name from Doctors where Doctor Name='xxx';
+        if (q.find("select doctor name from doctors") != string::npos &&
+            q.find("doctor name") != string::npos)
+        {
+            string name = getValueBetweenQuotes(query);
+            printDoctorByName(secDocName, name, out);
+            return true;
+        }
+
+        out << "Invalid query format.\n";
+        return false;
+    }
+
+    // Run independent queries on `workers` threads (0 = one per core). Each
+    // query holds shared locks on both tables while it runs, so the batch
+    // runs alongside other readers and only waits for writers. Returns each
+    // query's result and output, in the order given.
+    vector<pair<bool, string>> executeBatch(const vector<string>& queries, Database& db, unsigned workers = 0)
+    {
+        vector<pair<bool, string>> results(queries.size());
+        parallelFor(queries.size(), workers, [&](size_t i, unsigned) {
+            ostringstream out;
+            TableLocks hold = db.lock(Access::Read, Access::Read);
+            results[i].first = executeQuery(queries[i], db.doctorIndex, db.appIndex, db.secID, db.secName, out);
+            results[i].second = out.str();
+        });
+        return results;
+    }
+
+private:
+
+    string toLower(string s)
+    {
+        for (char& c : s)
+            c = tolower(c);
+        return s;
+    }
+
+    string getValueBetweenQuotes(const string& q)
+    {
+        int f = q.find("'");
+        int l = q.find_last_of("'");
+
+        if (f == -1 || l == -1 || l <= f)
+            return "";
+
+        return q.substr(f + 1, l - f - 1);
+    }
+
+    // Query 1: Using Primary Index (Doctors)
+    void printDoctorByID(PrimaryIndex& idx, const string& id, ostream& out)
+    {
+        long offset = idx.indexByID(id);
+
+        if (offset == -1)
+        {
+            out << "Doctor not found.\n";
+            return;
+        }
+
+        RecordFile& file = RecordFile::get("doctors.txt");
+        if (!file.isOpen())
+        {
+            out << "Error opening doctors.txt\n";
+            return;
+        }
+
+        auto cached = RecordCache::get().read("doctors.txt", offset);
+        string_view record = cached ? string_view(cached->line) : string_view();
+
+        if (record.size() > 3 && record[3] == '*')
+        {
+            out << "This record is deleted.\n";
+            return;
+        }
+
+        out << "\n=== Result ===\n" << record << "\n";
+    }
+
+
+    // Query 2: Using Secondary Index (Appointments)
+    void printAppointmentByDoctorID(SecondaryIndexDoctorID& sec, const string& id, ostream& out)
+    {
+        vector<pair<string, long>> results = sec.searchByID(id);
+
+        if (results.empty())
+        {
+            out << "No appointments found for this doctor.\n";
+            return;
+        }
+
+        out << "\n=== Appointments for Doctor " << id << " ===\n";
+
+
+        for (auto& p : results)
+        {
+            long offset = p.second;
+            string record = sec.getRecordAtOffset(offset);
+
+            if (record.empty())
+                continue;
+            if (record.size() > 3 && record[3] == '*')
+            {
+                out << "[DELETED RECORD]\n";
+                continue;
+            }
+            out << record << "\n";
+        }
+    }
+
+
+    // Query 3: Using Secondary Index (Doctors by Name)
+    void printDoctorByName(SecondaryIndexDoctorName& sec, const string& name, ostream& out)
+    {
+
+        auto result = sec.searchByName(name);
+
+        if (result.first == -1)
+        {
+            out << "Doctor name not found.\n";
+            return;
+        }
+
+        string record = result.second;
+        if (record.size() > 3 && record[3] == '*')
+        {
+            out << "[DELETED RECORD]\n";
+            return;
+        }
+        out << "\n=== Result ===\n" << record << "\n";
+    }
+};
+
+
+// ====================== Batch Mode ======================
+// Runs commands from a script instead of the menu, one per line:
+//   add-doctor|<name>|<address>
+//   add-appointment|<date>|<doctor id>
+//   update-doctor|<doctor id>|<new name>
+//   update-appointment|<appointment id>|<new date>
+//   delete-appointment|<appointment id>
+//   delete-doctor|<doctor id>
+//   doctor|<doctor id>
+//   appointment|<appointment id>
+//   query|<query>
+// Blank lines and lines starting with '#' are skipped. Every command
+// prints one tab-separated line: script line number, "ok" or "err", the
+// command, and what the command printed with its lines joined by "; ".
+// The summary at the end is on lines starting with '#'.
+//
+// Each command locks only the tables it uses. A run of consecutive query
+// lines goes to QueryManager::executeBatch and runs on the worker threads;
+// results are still printed in script order.
+class BatchRunner
+{
+private:
+    Database& db;
+    unsigned workers;
+    Insert ins;
+    UpdateManager um;
+    DeleteManager dm;
+    InfoManager info;
+    QueryManager qm;
+
+    struct Tally
+    {
+        long ok = 0;
+        long failed = 0;
+        double seconds = 0;
+    };
+    map<string, Tally> tallies;
+    // Queries held back by feed(), with their line numbers
+    vector<pair<long, string>> pending;
+
+    // The command and its arguments. The last argument keeps any '|' in it.
+    static vector<string> split(const string& line, size_t& arity)
+    {
+        static const map<string, size_t> arities = {
+            { "add-doctor", 2 }, { "add-appointment", 2 },
+            { "update-doctor", 2 }, { "update-appointment", 2 },
+            { "delete-appointment", 1 }, { "delete-doctor", 1 },
+            { "doctor", 1 }, { "appointment", 1 }, { "query", 1 }
+        };
+
+        vector<string> fields;
+        size_t bar = line.find('|');
+        fields.push_back(line.substr(0, bar));
+        auto it = arities.find(fields[0]);
+        arity = it == arities.end() ? 0 : it->second;
+
+        while (bar != string::npos && fields.size() < arity + 1)
+        {
+            size_t start = bar + 1;
+            bar = fields.size() < arity ? line.find('|', start) : string::npos;
+            fields.push_back(line.substr(start, bar == string::npos ? string::npos : bar - start));
+        }
+        return fields;
+    }
+
+    bool dispatch(const vector<string>& f, ostream& out)
+    {
+        const string& cmd = f[0];
+        if (cmd == "add-doctor")
+            return ins.insertDoctor(f[1], f[2], db.doctorIndex, db.secName, out);
+        if (cmd == "add-appointment")
+            return ins.insertAppointment(f[1], f[2], db.appIndex, db.secID, out);
+        if (cmd == "update-doctor")
+            return um.updateDoctorName(db.doctorIndex, db.secName, f[1], f[2], out);
+        if (cmd == "update-appointment")
+            return um.updateAppointmentDate(db.appIndex, f[1], f[2], out);
+        if (cmd == "delete-appointment")
+            return dm.deleteAppointment(db.appIndex, db.secID, f[1], out);
+        if (cmd == "delete-doctor")
+            return dm.deleteDoctor(db.doctorIndex, db.secName, f[1], out);
+        if (cmd == "doctor")
+            return info.printDoctorInfo(db.doctorIndex, f[1], out);
+        if (cmd == "appointment")
+            return info.printAppointmentInfo(db.appIndex, f[1], out);
+        return qm.executeQuery(f[1], db.doctorIndex, db.appIndex, db.secID, db.secName, out);
+    }
+
+    // Output lines without the blank and "=== ... ===" decoration
+    static string flatten(const string& text)
+    {
+        string result, line;
+        istringstream in(text);
+        while (getline(in, line))
+        {
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == string::npos || line.compare(start, 3, "===") == 0)
+                continue;
+            line = line.substr(start);
+            replace(line.begin(), line.end(), '\t', ' ');
+            if (!result.empty()) result += "; ";
+            result += line;
+        }
+        return result;
+    }
+
+    // The tables each command reads or writes
+    TableLocks lockFor(const string& cmd)
+    {
+        if (cmd == "add-doctor" || cmd == "update-doctor" || cmd == "delete-doctor")
+            return db.lock(Access::Write, Access::None);
+        if (cmd == "add-appointment")
+            return db.lock(Access::Read, Access::Write);
+        if (cmd == "update-appointment" || cmd == "delete-appointment")
+            return db.lock(Access::None, Access::Write);
+        if (cmd == "doctor")
+            return db.lock(Access::Read, Access::None);
+        if (cmd == "appointment")
+            return db.lock(Access::None, Access::Read);
+        return db.lock(Access::Read, Access::Read);
+    }
+
+    // A lookup found a secondary index out of step with its data file
+    void rebuildStaleIndexes(ostream& out)
+    {
+        if (!db.secID.needsRebuild() && !db.secName.needsRebuild())
+            return;
+        TableLocks hold = db.exclusive();
+        if (db.secID.needsRebuild())
+            db.secID.createIndex(ExternalSorter::DefaultBudget, 0, out);
+        if (db.secName.needsRebuild())
+            db.secName.createIndex(ExternalSorter::DefaultBudget, 0, out);
+    }
+
+    // Split a script line into the command and its arguments. Returns false
+    // for a skipped line, or (after printing its result line) a malformed one.
+    bool parse(const string& rawLine, long lineNo, ostream& out, vector<string>& fields, bool& ok)
+    {
+        ok = true;
+        string line = rawLine;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        size_t start = line.find_first_not_of(" \t");
+        if (start == string::npos || line[start] == '#')
+            return false;
+        line = line.substr(start);
+
+        size_t arity;
+        fields = split(line, arity);
+        const string& cmd = fields[0];
+
+        if (arity == 0)
+        {
+            out << lineNo << "\terr\t" << cmd << "\tUnknown command.\n";
+            tallies[cmd].failed++;
+            ok = false;
+            return false;
+        }
+        if (fields.size() != arity + 1)
+        {
+            out << lineNo << "\terr\t" << cmd << "\tExpected " << arity << " argument(s).\n";
+            tallies[cmd].failed++;
+            ok = false;
+            return false;
+        }
+        return true;
+    }
+
+    void report(long lineNo, const string& cmd, bool ok, const string& printed, ostream& out)
+    {
+        out << lineNo << "\t" << (ok ? "ok" : "err") << "\t" << cmd << "\t" << flatten(printed) << "\n";
+    }
+
+    void runQueries(ostream& out)
+    {
+        if (pending.empty()) return;
+
+        vector<string> queries;
+        for (const auto& p : pending)
+            queries.push_back(p.second);
+
+        auto begin = chrono::steady_clock::now();
+        ostringstream rebuilt;      // not part of any query's result
+        rebuildStaleIndexes(rebuilt);
+        vector<pair<bool, string>> results = qm.executeBatch(queries, db, workers);
+
+        Tally& tally = tallies["query"];
+        tally.seconds += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            (results[i].first ? tally.ok : tally.failed)++;
+            report(pending[i].first, "query", results[i].first, results[i].second, out);
+        }
+        pending.clear();
+    }
+
+public:
+    // workers: threads for runs of queries (0 = one per core)
+    explicit BatchRunner(Database& database, unsigned workerCount = 0)
+            : db(database), workers(workerCount), ins(database), um(database), dm(database) {}
+
+    // Run one script line and print its result line. Returns false if the
+    // command failed or was malformed; skipped lines count as success.
+    bool execute(const string& rawLine, long lineNo, ostream& out)
+    {
+        vector<string> fields;
+        bool ok;
+        if (!parse(rawLine, lineNo, out, fields, ok))
+            return ok;
+        const string& cmd = fields[0];
+
+        auto begin = chrono::steady_clock::now();
+        ostringstream printed;
+        rebuildStaleIndexes(printed);
+        {
+            TableLocks hold = lockFor(cmd);
+            ok = dispatch(fields, printed);
+            ok = hold.release() && ok;
+        }
+        Tally& tally = tallies[cmd];
+        tally.seconds += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        (ok ? tally.ok : tally.failed)++;
+
+        report(lineNo, cmd, ok, printed.str(), out);
+        return ok;
+    }
+
+    // Take the next script line. Runs of queries are held back and executed
+    // together, so a query's result line may only appear once the run ends
+    // (at the next other command or flush()).
+    void feed(const string& line, long lineNo, ostream& out)
+    {
+        vector<string> fields;
+        bool ok;
+        ostringstream malformed;
+        bool runnable = parse(line, lineNo, malformed, fields, ok);
+        if (!runnable && ok)
+            return;
+
+        if (runnable && fields[0] == "query")
+        {
+            pending.push_back({ lineNo, fields[1] });
+            return;
+        }
+        runQueries(out);
+        out << malformed.str();
+        if (runnable)
+            execute(line, lineNo, out);
+    }
+
+    // Run the queries still held back
+    void flush(ostream& out)
+    {
+        runQueries(out);
+    }
+
+    void printSummary(double elapsed, ostream& out)
+    {
+        long ok = 0, failed = 0;
+        for (const auto& t : tallies)
+        {
+            ok += t.second.ok;
+            failed += t.second.failed;
+        }
+        out << "# commands " << ok + failed << " ok " << ok << " failed " << failed
+            << " seconds " << elapsed << " ops/sec " << (elapsed > 0 ? (ok + failed) / elapsed : 0) << "\n";
+        for (const auto& t : tallies)
+        {
+            out << "# " << t.first << " ok " << t.second.ok << " failed " << t.second.failed
+                << " seconds " << t.second.seconds << "\n";
+        }
+    }
+
+    // Run a whole script, then print the summary
+    void run(istream& in, ostream& out)
+    {
+        auto begin = chrono::steady_clock::now();
+        string line;
+        long lineNo = 0;
+        while (getline(in, line))
+            feed(line, ++lineNo, out);
+        flush(out);
+        printSummary(chrono::duration<double>(chrono::steady_clock::now() - begin).count(), out);
+    }
+};
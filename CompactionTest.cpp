@@ -0,0 +1,212 @@
+#include "TestSupport.h"
+
+// Free space and compaction on a small doctors file: holes are split on
+// reuse and merged with their neighbours, and a compaction that stops
+// between segments (or dies there) gives its space back.
+
+static const char* AppIndex = "AppointmentsIndexfile.idx";
+static const char* DocIndex = "DocIndexFile.idx";
+static const int Doctors = 20;
+
+// Doctors still expected, by ID
+static map<string, string> live;
+
+static void writeDoctors()
+{
+    ofstream doctors("doctors.txt", ios::trunc);
+    for (int i = 1; i <= Doctors; ++i)
+    {
+        string id = IdSequence::formatID(i);
+        doctors << Insert::buildDoctorRecord(id, "Doctor " + id, "Street") << "\n";
+        live[id] = "Doctor " + id;
+    }
+    ofstream appointments("appointments.txt", ios::trunc);
+}
+
+static string recordAt(long offset)
+{
+    return RecordFile::get("doctors.txt").readLine(offset);
+}
+
+static bool removeDoctor(Database& db, const string& id)
+{
+    DeleteManager dm(db);
+    TableLocks hold = db.lock(Access::Write, Access::None);
+    bool done = dm.deleteDoctor(db.doctorIndex, db.secName, id);
+    live.erase(id);
+    return hold.release() && done;
+}
+
+// The ID the doctor got
+static string addDoctor(Database& db, const string& name)
+{
+    Insert ins(db);
+    ostringstream out;
+    TableLocks hold = db.lock(Access::Write, Access::None);
+    ins.insertDoctor(name, "St", db.doctorIndex, db.secName, out);
+    hold.release();
+    string printed = out.str();
+    size_t colon = printed.find(": ");
+    string id = colon == string::npos ? "" : printed.substr(colon + 2, printed.find('\n') - colon - 2);
+    if (!id.empty()) live[id] = name;
+    return id;
+}
+
+// Every expected doctor is found by ID and by name, not tombstoned
+static bool allLive(Database& db)
+{
+    for (const auto& d : live)
+    {
+        long offset = db.doctorIndex.indexByID(d.first);
+        string record = offset == -1 ? "" : recordAt(offset);
+        if (record.size() < 4 || record[3] == '*' || record.find("|" + d.second + "|") == string::npos ||
+            db.secName.searchByName(d.second).first != offset)
+            return false;
+    }
+    return true;
+}
+
+// Every registered hole is a tombstone of exactly its length
+static bool holesOnDisk(Database& db)
+{
+    for (const FreeSlot& slot : db.doctorsSpace.slots())
+    {
+        string record = recordAt(slot.offset);
+        if ((int)record.size() != slot.length || record[3] != '*')
+            return false;
+    }
+    return true;
+}
+
+static bool holeTests(Database& db)
+{
+    bool ok = true;
+    long start = db.doctorIndex.indexByID("02");
+    long second = db.doctorIndex.indexByID("03");
+    long end = second + (long)recordAt(second).size();
+
+    // Neighbouring tombstones become one hole
+    ok = check(removeDoctor(db, "02") && removeDoctor(db, "03"), "delete two neighbours") && ok;
+    vector<FreeSlot> slots = db.doctorsSpace.slots();
+    ok = check(slots.size() == 1 && slots[0].offset == start && slots[0].offset + slots[0].length == end,
+               "adjacent holes coalesce") && ok;
+
+    // A short record takes the front of the hole and leaves the rest
+    string id = addDoctor(db, "Dr A");
+    slots = db.doctorsSpace.slots();
+    ok = check(db.doctorIndex.indexByID(id) == start, "insert reuses the hole") && ok;
+    ok = check(slots.size() == 1 && slots[0].offset > start && slots[0].offset + slots[0].length == end,
+               "the rest of the hole is split off") && ok;
+
+    // The leftover merges with the next record once that is deleted too
+    long next = db.doctorIndex.indexByID("04");
+    long nextEnd = next + (long)recordAt(next).size();
+    long rest = slots.empty() ? -1 : slots[0].offset;
+    ok = check(removeDoctor(db, "04"), "delete the next neighbour") && ok;
+    slots = db.doctorsSpace.slots();
+    ok = check(slots.size() == 1 && slots[0].offset == rest && slots[0].offset + slots[0].length == nextEnd,
+               "a split-off hole coalesces again") && ok;
+    ok = check(holesOnDisk(db) && allLive(db), "holes and records intact") && ok;
+    return ok;
+}
+
+static bool stoppedRunTests(Database& db)
+{
+    bool ok = true;
+    for (const char* id : { "08", "10", "12", "14", "16" })
+        ok = check(removeDoctor(db, id), string("delete ") + id) && ok;
+
+    bool done = false;
+    {
+        TableLocks hold = db.exclusive();
+        db.doctorsCompactor.start();
+        done = db.doctorsCompactor.step(40);
+        done = db.doctorsCompactor.step(40) || done;
+        ok = check(filesystem::exists("doctors.txt.compacting"), "marker while running") && ok;
+        db.doctorsCompactor.stop();
+    }
+    ok = check(!done, "run stopped between segments") && ok;
+    ok = check(!filesystem::exists("doctors.txt.compacting"), "stop removes the marker") && ok;
+    ok = check(!db.doctorsSpace.empty() && holesOnDisk(db), "a stopped run registers its holes") && ok;
+    ok = check(allLive(db), "records intact after a stopped run") && ok;
+
+    long size = (long)filesystem::file_size("doctors.txt");
+    addDoctor(db, "Dr B");
+    ok = check((long)filesystem::file_size("doctors.txt") == size, "the freed space is reused") && ok;
+    return ok;
+}
+
+// Dies between segments, leaving the marker behind. The run is checkpointed
+// first, as the background checkpointer may do, so open has no log to replay
+// and only the marker says the free space needs rebuilding.
+static void crashMidRun()
+{
+    NullBuffer null;
+    cout.rdbuf(&null);
+    Database db(AppIndex, DocIndex);
+    db.open();
+    removeDoctor(db, "18");
+    {
+        TableLocks hold = db.exclusive();
+        db.doctorsCompactor.start();
+        db.doctorsCompactor.step(40);
+        db.checkpoint();
+    }
+    ::_exit(0);
+}
+
+int main()
+{
+    filesystem::path dir = enterScratch("compaction");
+    writeDoctors();
+
+    NullBuffer null;
+    streambuf* saved = cout.rdbuf(&null);
+    bool ok = true;
+    {
+        Database db(AppIndex, DocIndex);
+        db.open();
+        ok = holeTests(db) && ok;
+        ok = stoppedRunTests(db) && ok;
+        db.close();
+    }
+
+    // The holes survive a reopen
+    {
+        Database db(AppIndex, DocIndex);
+        db.open();
+        ok = check(!db.doctorsSpace.empty() && holesOnDisk(db) && allLive(db), "holes after reopen") && ok;
+        db.close();
+    }
+    cout.rdbuf(saved);
+
+    ok = check(inChild(crashMidRun), "crashed run") && ok;
+    live.erase("18");
+    ok = check(filesystem::exists("doctors.txt.compacting"), "a crash leaves the marker") && ok;
+
+    cout.rdbuf(&null);
+    {
+        Database db(AppIndex, DocIndex);
+        db.open();
+        ok = check(!filesystem::exists("doctors.txt.compacting"), "open handles the marker") && ok;
+        ok = check(!db.doctorsSpace.empty() && holesOnDisk(db), "holes recovered after a crash") && ok;
+        ok = check(allLive(db), "records intact after a crash") && ok;
+
+        // A full run leaves no tombstones and no holes
+        long size = (long)filesystem::file_size("doctors.txt");
+        db.compactNow();
+        string data = readFile("doctors.txt");
+        bool tombstones = false;
+        istringstream lines(data);
+        string line;
+        while (getline(lines, line))
+            tombstones = tombstones || (line.size() > 3 && line[3] == '*');
+        ok = check(!tombstones && db.doctorsSpace.empty(), "full compaction removes every tombstone") && ok;
+        ok = check((long)data.size() < size && allLive(db), "full compaction keeps the records") && ok;
+        db.close();
+    }
+    cout.rdbuf(saved);
+
+    leaveScratch(dir);
+    return ok ? 0 : 1;
+}
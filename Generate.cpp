@@ -0,0 +1,73 @@
+#include "Generator.h"
+
+// Writes a synthetic dataset (data, index, avail-list and sequence files)
+// into a directory:
+//
+//   hms_gen [--dir path] [--doctors N] [--appointments N] [--seed N]
+//           [--zipf s] [--deleted-doctors f] [--deleted-appointments f]
+//
+// The same options always produce the same files.
+int main(int argc, char* argv[])
+{
+    DatasetSpec spec;
+    string dir = ".";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            cout << "Error: " << arg << " needs a value.\n";
+            return 1;
+        }
+        string value = argv[++i];
+
+        if (arg == "--dir")
+            dir = value;
+        else if (arg == "--doctors")
+            spec.doctors = atol(value.c_str());
+        else if (arg == "--appointments")
+            spec.appointments = atol(value.c_str());
+        else if (arg == "--seed")
+            spec.seed = strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--zipf")
+            spec.zipf = atof(value.c_str());
+        else if (arg == "--deleted-doctors")
+            spec.deletedDoctors = atof(value.c_str());
+        else if (arg == "--deleted-appointments")
+            spec.deletedAppointments = atof(value.c_str());
+        else
+        {
+            cout << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (spec.zipf < 0 || spec.deletedDoctors < 0 || spec.deletedDoctors > 1 ||
+        spec.deletedAppointments < 0 || spec.deletedAppointments > 1)
+    {
+        cout << "Error: --zipf must be >= 0 and the deleted fractions between 0 and 1.\n";
+        return 1;
+    }
+
+    error_code ec;
+    filesystem::create_directories(dir, ec);
+    filesystem::current_path(dir, ec);
+    if (ec)
+    {
+        cout << "Error: Cannot use directory " << dir << "\n";
+        return 1;
+    }
+
+    auto begin = chrono::steady_clock::now();
+    DatasetGenerator gen(spec);
+    if (!gen.generate())
+        return 1;
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    cout << "Generated " << spec.doctors << " doctors (" << gen.deletedDoctors() << " deleted) and "
+         << spec.appointments << " appointments (" << gen.deletedAppointments() << " deleted), seed "
+         << spec.seed << ", zipf " << spec.zipf << ", busiest doctor has " << gen.busiestDoctor()
+         << " appointments, in " << elapsed << " s.\n";
+    return 0;
+}
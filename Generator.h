@@ -0,0 +1,230 @@
+// Seeded synthetic datasets in the on-disk format, for load tests,
+// benchmarks and reproducible bug reports.
+#pragma once
+
+#include "Commands.h"
+
+#include <random>
+#include <numeric>
+#include <cmath>
+
+struct DatasetSpec
+{
+    long doctors = 1000;
+    long appointments = 10000;
+    uint64_t seed = 1;
+    // Exponent of the Zipf distribution of appointments over doctors;
+    // 0 spreads them uniformly
+    double zipf = 1.0;
+    // Fraction of records left behind as tombstones
+    double deletedDoctors = 0.05;
+    double deletedAppointments = 0.10;
+};
+
+// Writes doctors.txt and appointments.txt into the working directory,
+// records built exactly as Insert builds them and deleted ones tombstoned
+// in place the way DeleteManager leaves them. The index, avail-list and
+// sequence files are then derived from the data files by the same code
+// that rebuilds them at run time, so they are consistent by construction.
+// The same spec always produces byte-identical files.
+class DatasetGenerator
+{
+private:
+    static const size_t FlushBytes = 4 << 20;
+
+    DatasetSpec spec;
+    mt19937_64 rng;
+    long deletedDoctorCount = 0;
+    long deletedAppointmentCount = 0;
+    long busiestDoctorAppointments = 0;
+
+    string address()
+    {
+        static const char* streets[] = {
+            "Tahrir", "Nile", "Pyramids", "Corniche", "Salah Salem", "Abbas",
+            "Gameat El Dowal", "Shubra", "Faisal", "Merghany", "Orabi", "Ramses"
+        };
+        static const char* cities[] = {
+            "Cairo", "Giza", "Alexandria", "Mansoura", "Tanta", "Aswan", "Luxor", "Suez"
+        };
+        uniform_int_distribution<int> number(1, 250);
+        uniform_int_distribution<size_t> street(0, sizeof(streets) / sizeof(streets[0]) - 1);
+        uniform_int_distribution<size_t> city(0, sizeof(cities) / sizeof(cities[0]) - 1);
+        return to_string(number(rng)) + " " + streets[street(rng)] + " Street, " + cities[city(rng)];
+    }
+
+    string date()
+    {
+        static const char* months[] = {
+            "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec"
+        };
+        uniform_int_distribution<int> day(1, 28);
+        uniform_int_distribution<int> month(0, 11);
+        string d = to_string(day(rng));
+        if (d.length() == 1) d = "0" + d;
+        return d + " " + months[month(rng)];
+    }
+
+    // Deleted records keep their bytes; only the byte after the length
+    // header turns into '*'
+    static void tombstone(string& record) { record[3] = '*'; }
+
+    static bool flush(ofstream& out, string& buffer, bool force)
+    {
+        if (!force && buffer.size() < FlushBytes) return true;
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+        return (bool)out;
+    }
+
+    bool writeDoctors()
+    {
+        ofstream out("doctors.txt", ios::binary | ios::trunc);
+        if (!out)
+        {
+            cout << "Error: Cannot create doctors.txt!\n";
+            return false;
+        }
+
+        bernoulli_distribution deleted(spec.deletedDoctors);
+        string buffer;
+        for (long i = 1; i <= spec.doctors; ++i)
+        {
+            string record = Insert::buildDoctorRecord(IdSequence::formatID(i), doctorName(i - 1), address());
+            if (deleted(rng))
+            {
+                tombstone(record);
+                deletedDoctorCount++;
+            }
+            buffer += record;
+            buffer += '\n';
+            if (!flush(out, buffer, false)) return false;
+        }
+        return flush(out, buffer, true);
+    }
+
+    // Doctor ranks follow Zipf(s); a seeded shuffle decides which doctor
+    // holds which rank, so the busy ones are spread through the file
+    bool writeAppointments()
+    {
+        ofstream out("appointments.txt", ios::binary | ios::trunc);
+        if (!out)
+        {
+            cout << "Error: Cannot create appointments.txt!\n";
+            return false;
+        }
+
+        vector<long> doctorOfRank(spec.doctors);
+        iota(doctorOfRank.begin(), doctorOfRank.end(), 1);
+        shuffle(doctorOfRank.begin(), doctorOfRank.end(), rng);
+
+        vector<double> cdf(spec.doctors);
+        double total = 0;
+        for (long r = 0; r < spec.doctors; ++r)
+        {
+            total += spec.zipf == 0 ? 1.0 : 1.0 / pow((double)(r + 1), spec.zipf);
+            cdf[r] = total;
+        }
+
+        uniform_real_distribution<double> pick(0, total);
+        bernoulli_distribution deleted(spec.deletedAppointments);
+        vector<long> perRank(spec.doctors, 0);
+        string buffer;
+        for (long i = 1; i <= spec.appointments; ++i)
+        {
+            long rank = lower_bound(cdf.begin(), cdf.end(), pick(rng)) - cdf.begin();
+            if (rank >= spec.doctors) rank = spec.doctors - 1;
+            perRank[rank]++;
+
+            string record = Insert::buildAppointmentRecord(IdSequence::formatID(i), date(),
+                                                           IdSequence::formatID(doctorOfRank[rank]));
+            if (deleted(rng))
+            {
+                tombstone(record);
+                deletedAppointmentCount++;
+            }
+            buffer += record;
+            buffer += '\n';
+            if (!flush(out, buffer, false)) return false;
+        }
+        busiestDoctorAppointments = *max_element(perRank.begin(), perRank.end());
+        return flush(out, buffer, true);
+    }
+
+    // Anything derived from an older dataset in this directory
+    static void removeDerivedFiles()
+    {
+        const char* files[] = {
+            "AppointmentsIndexfile.idx", "DocIndexFile.idx",
+            "AppointmentsIndexfile.bpt", "DocIndexFile.bpt",
+            "AppointmentsIndexfile.idx.delta", "DocIndexFile.idx.delta",
+            "AppointmentsIndexfile.bpt.delta", "DocIndexFile.bpt.delta",
+            "AppointmentsIndexfile.idx.journal", "DocIndexFile.idx.journal",
+            "AppointmentsIndexfile.bpt.journal", "DocIndexFile.bpt.journal",
+            "SecondryIndex_DoctorId_App.txt", "SecondryIndex_DoctorId_App.txt.delta",
+            "SecondryIndex_DoctorName.txt", "SecondryIndex_DoctorName.txt.delta",
+            "doctorsAvailList.txt", "appointmentsAvailList.txt",
+            "doctorsSequence.txt", "appointmentsSequence.txt", "database.wal",
+            "doctors.txt.compacting", "appointments.txt.compacting"
+        };
+        error_code ec;
+        for (const char* f : files)
+            filesystem::remove(f, ec);
+    }
+
+public:
+    explicit DatasetGenerator(const DatasetSpec& s) : spec(s), rng(s.seed) {}
+
+    // Name of the doctor with ID i + 1
+    static string doctorName(long i)
+    {
+        static const char* first[] = {
+            "Ahmed", "Mohamed", "Sara", "Mona", "Omar", "Laila", "Youssef", "Nour",
+            "Karim", "Hana", "Tarek", "Dina", "Mostafa", "Salma", "Khaled", "Yasmin",
+            "Hassan", "Aya", "Mahmoud", "Farida", "Ali", "Rania", "Amr", "Mariam"
+        };
+        static const char* last[] = {
+            "Hassan", "Sherif", "Mansour", "Fahmy", "Saleh", "Nabil", "Ezzat", "Gamal",
+            "Shawky", "Helmy", "Adel", "Fouad", "Ramadan", "Kamel", "Zaki", "Badawi",
+            "Soliman", "Naguib", "Lotfy", "Hamdy"
+        };
+        const long firstCount = sizeof(first) / sizeof(first[0]);
+        const long lastCount = sizeof(last) / sizeof(last[0]);
+
+        // Unique by construction: names are checked case-insensitively
+        string name = string(first[i % firstCount]) + " " + last[(i / firstCount) % lastCount];
+        long round = i / (firstCount * lastCount);
+        if (round > 0)
+            name += " " + to_string(round + 1);
+        return name;
+    }
+
+    bool generate()
+    {
+        if (spec.doctors < 1 || spec.appointments < 0)
+        {
+            cout << "Error: Need at least one doctor!\n";
+            return false;
+        }
+
+        removeDerivedFiles();
+        if (!writeDoctors() || !writeAppointments())
+            return false;
+
+        Database db("AppointmentsIndexfile.idx", "DocIndexFile.idx");
+        bool ok = db.doctorIndex.rebuild() && db.appIndex.rebuild();
+        db.secID.createIndex();
+        db.secName.createIndex();
+        // Loads what was just built and recovers the sequences from the
+        // primary indexes
+        db.open();
+        db.doctorsSpace.rebuild();
+        db.appointmentsSpace.rebuild();
+        db.close();
+        return ok;
+    }
+
+    long deletedDoctors() const { return deletedDoctorCount; }
+    long deletedAppointments() const { return deletedAppointmentCount; }
+    long busiestDoctor() const { return busiestDoctorAppointments; }
+};
@@ -0,0 +1,98 @@
+#include "TestSupport.h"
+
+// Concurrent writers of different tables must share log syncs: each one
+// lets go of the writer lock once its record is queued and keeps only its
+// table locked while it waits, so a writer of the other table queues behind
+// the fsync in progress and goes out with the next one.
+
+int main()
+{
+    const int Writers = 8;
+    const int PerWriter = 20;       // well below a checkpoint's worth
+
+    filesystem::path dir = enterScratch("group_commit");
+
+    NullBuffer null;
+    streambuf* saved = cout.rdbuf(&null);
+
+    DatasetSpec spec;
+    spec.doctors = 100;
+    spec.appointments = 200;
+    spec.deletedAppointments = 0;       // every ID below can be rescheduled
+    bool ok = check(DatasetGenerator(spec).generate(), "generate dataset");
+
+    uint64_t fsyncs, commits;
+    {
+        Database db("AppointmentsIndexfile.idx", "DocIndexFile.idx");
+        db.open();
+
+        Stats& stats = Stats::get();
+        uint64_t fsyncsBefore = stats.counter(Stats::Fsyncs);
+        uint64_t commitsBefore = stats.counter(Stats::LogCommits);
+
+        vector<thread> writers;
+        atomic<int> failed{ 0 };
+        for (int w = 0; w < Writers; ++w)
+        {
+            // Even writers add doctors, odd ones reschedule appointments
+            writers.emplace_back([&, w] {
+                Insert ins(db);
+                UpdateManager um(db);
+                for (int i = 0; i < PerWriter; ++i)
+                {
+                    bool done;
+                    TableLocks hold;
+                    if (w % 2 == 0)
+                    {
+                        hold = db.lock(Access::Write, Access::None);
+                        done = ins.insertDoctor("Writer " + to_string(w) + " " + to_string(i), "Street",
+                                                db.doctorIndex, db.secName);
+                    }
+                    else
+                    {
+                        hold = db.lock(Access::None, Access::Write);
+                        done = um.updateAppointmentDate(db.appIndex, to_string(w * PerWriter + i + 1), "Day " + to_string(i));
+                    }
+                    if (!hold.release() || !done) failed++;
+                }
+            });
+        }
+        for (thread& t : writers)
+            t.join();
+
+        fsyncs = stats.counter(Stats::Fsyncs) - fsyncsBefore;
+        commits = stats.counter(Stats::LogCommits) - commitsBefore;
+        ok = check(failed == 0, "every insert commits") && ok;
+        db.close();
+    }
+    cout.rdbuf(saved);
+
+    ok = check(commits == (uint64_t)(Writers * PerWriter), "one log record per insert") && ok;
+    ok = check(fsyncs > 0 && fsyncs < commits, "writers share log syncs") && ok;
+    cout << commits << " commits, " << fsyncs << " fsyncs\n";
+
+    // Everything acknowledged is there after a reopen
+    {
+        cout.rdbuf(&null);
+        Database db("AppointmentsIndexfile.idx", "DocIndexFile.idx");
+        db.open();
+        long found = 0;
+        for (int w = 0; w < Writers; w += 2)
+            for (int i = 0; i < PerWriter; ++i)
+                if (db.secName.nameExists("Writer " + to_string(w) + " " + to_string(i)))
+                    found++;
+        for (int w = 1; w < Writers; w += 2)
+            for (int i = 0; i < PerWriter; ++i)
+            {
+                string record = RecordFile::get("appointments.txt").readLine(db.appIndex.indexByID(to_string(w * PerWriter + i + 1)));
+                if (record.find("|Day " + to_string(i) + "|") != string::npos)
+                    found++;
+            }
+        db.close();
+        cout.rdbuf(saved);
+        ok = check(found == Writers * PerWriter, "committed changes survive a reopen") && ok;
+    }
+
+    leaveScratch(dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+#include "TestSupport.h"
+
+// Crash recovery: the write-ahead log replays what was synced but never
+// applied and stops at a torn tail, and the B+ tree's page journal is
+// applied once committed and dropped otherwise.
+
+static const char* AppIndex = "AppointmentsIndexfile.idx";
+static const char* DocIndex = "DocIndexFile.idx";
+
+// Doctor names the crashed run inserted
+static const string Applied = "Applied Before Crash";
+static const string Logged = "Logged Not Applied";
+
+// One insert that completes, then one whose process dies right after its
+// log record is synced, before the flusher applies it
+static void crashAfterLogSync()
+{
+    DatasetSpec spec;
+    spec.doctors = 50;
+    spec.appointments = 50;
+    DatasetGenerator(spec).generate();
+
+    Database db(AppIndex, DocIndex);
+    db.open();
+    Insert ins(db);
+    {
+        TableLocks hold = db.lock(Access::Write, Access::None);
+        ins.insertDoctor(Applied, "Street", db.doctorIndex, db.secName);
+    }
+    crashAfterSyncs() = 1;
+    TableLocks hold = db.lock(Access::Write, Access::None);
+    ins.insertDoctor(Logged, "Street", db.doctorIndex, db.secName);
+    hold.release();
+    ::_exit(1);             // not reached: the sync above ends the process
+}
+
+static bool walTests()
+{
+    bool ok = true;
+    filesystem::path crashed = enterScratch("recovery_wal");
+    ok = check(inChild(crashAfterLogSync), "crashed run") && ok;
+    ok = check(readFile("doctors.txt").find(Logged) == string::npos,
+               "no data-file byte reaches the disk before its log record") && ok;
+
+    // A second copy whose log lost the end of its last record
+    filesystem::path torn = crashed.string() + "_torn";
+    filesystem::remove_all(torn);
+    filesystem::copy(crashed, torn);
+    filesystem::resize_file(torn / "database.wal", filesystem::file_size(torn / "database.wal") - 1);
+
+    NullBuffer null;
+    streambuf* saved = cout.rdbuf(&null);
+    bool replayedBoth, torntailApplied, appliedKept;
+    {
+        Database db(AppIndex, DocIndex);
+        db.open();
+        replayedBoth = db.secName.nameExists(Applied) && db.secName.nameExists(Logged);
+        db.close();
+    }
+    filesystem::current_path(torn);
+    {
+        Database db(AppIndex, DocIndex);
+        db.open();
+        appliedKept = db.secName.nameExists(Applied);
+        torntailApplied = db.secName.nameExists(Logged) || readFile("doctors.txt").find(Logged) != string::npos;
+        db.close();
+    }
+    cout.rdbuf(saved);
+
+    ok = check(replayedBoth, "a synced transaction is replayed on open") && ok;
+    ok = check(appliedKept, "transactions before a torn tail survive") && ok;
+    ok = check(!torntailApplied, "a torn tail record is not replayed") && ok;
+
+    leaveScratch(torn);
+    leaveScratch(crashed);
+    return ok;
+}
+
+static string key(int i)
+{
+    char k[16];
+    snprintf(k, sizeof(k), "k%06d", i);
+    return k;
+}
+
+// Keys in a scattered order, so inserts land all over the tree
+static vector<int> shuffled(int from, int to)
+{
+    vector<int> v;
+    for (int i = from; i < to; ++i)
+        v.push_back(i);
+    shuffle(v.begin(), v.end(), mt19937(7));
+    return v;
+}
+
+// A cache of the minimum 16 frames, so inserts evict dirty pages into the
+// journal long before any flush
+static const int Before = 4000;         // flushed
+static const int After = 30000;         // enough for internal node splits
+
+static void fillTree(bool commitSecondBatch)
+{
+    BPlusTree tree(0);
+    tree.open("tree.bpt");
+    for (int i : shuffled(0, Before))
+        tree.upsert(key(i), i);
+    tree.flush();
+    for (int i : shuffled(Before, After))
+        tree.upsert(key(i), i);
+    // The first sync of flush() is the journal's, after its commit record
+    if (commitSecondBatch)
+    {
+        crashAfterSyncs() = 1;
+        tree.flush();
+    }
+    ::_exit(0);
+}
+
+// Count of keys in [from, to) found with the right offset
+static int found(BPlusTree& tree, int from, int to)
+{
+    int n = 0;
+    for (int i = from; i < to; ++i)
+        if (tree.find(key(i)) == i)
+            n++;
+    return n;
+}
+
+static bool treeTests()
+{
+    bool ok = true;
+    filesystem::path dir = enterScratch("recovery_tree");
+
+    // Splits: everything is found, in order, before and after a reopen
+    {
+        BPlusTree tree(0);
+        ok = check(tree.open("splits.bpt"), "create tree") && ok;
+        for (int i : shuffled(0, After))
+            tree.upsert(key(i), i);
+        tree.erase(key(17));
+        ok = check(found(tree, 0, After) == After - 1 && tree.size() == (size_t)After - 1, "lookups after splits") && ok;
+        tree.close();
+
+        BPlusTree reopened(0);
+        reopened.open("splits.bpt");
+        string last;
+        int scanned = 0;
+        bool ordered = true;
+        reopened.scan("", "", [&](string_view k, long) {
+            ordered = ordered && string(k) > last;
+            last = string(k);
+            scanned++;
+            return true;
+        });
+        ok = check(ordered && scanned == After - 1, "ordered scan after reopen") && ok;
+        ok = check(found(reopened, 0, After) == After - 1, "lookups after reopen") && ok;
+    }
+
+    // A crash before the second batch's commit record: the batch is gone
+    ok = check(inChild([] { fillTree(false); }), "uncommitted run") && ok;
+    ok = check(filesystem::file_size("tree.bpt.journal") > 0, "evicted pages went to the journal") && ok;
+    {
+        BPlusTree tree(0);
+        ok = check(tree.open("tree.bpt"), "open after uncommitted crash") && ok;
+        ok = check(found(tree, 0, Before) == Before && found(tree, Before, After) == 0 &&
+                   tree.size() == (size_t)Before, "an uncommitted journal is dropped") && ok;
+    }
+    filesystem::remove("tree.bpt");
+    filesystem::remove("tree.bpt.journal");
+
+    // A crash after the commit record is synced: the batch is applied
+    ok = check(inChild([] { fillTree(true); }), "committed run") && ok;
+    ok = check(filesystem::file_size("tree.bpt.journal") > 0, "committed journal left behind") && ok;
+    {
+        BPlusTree tree(0);
+        ok = check(tree.open("tree.bpt"), "open after committed crash") && ok;
+        ok = check(found(tree, 0, After) == After && tree.size() == (size_t)After,
+                   "a committed journal is applied") && ok;
+        ok = check(filesystem::file_size("tree.bpt.journal") == 0, "journal emptied by recovery") && ok;
+    }
+
+    leaveScratch(dir);
+    return ok;
+}
+
+int main()
+{
+    bool ok = walTests();
+    ok = treeTests() && ok;
+    return ok ? 0 : 1;
+}
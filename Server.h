@@ -0,0 +1,384 @@
+// Daemon mode: one process owns the database and serves many clients over
+// a Unix domain socket, so the indexes stay loaded between requests.
+#pragma once
+
+#include "Commands.h"
+
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// The protocol is the batch script format (see BatchRunner), one request
+// per line. Every request gets one tab-separated response line: the
+// request's number on this connection, "ok" or "err", the command, and its
+// output. Blank and '#' lines get no response, and "quit" closes the
+// connection. Clients can pipeline; responses come back in request order.
+// Any line-oriented tool works as a client, e.g.
+//
+//   printf 'doctor|05\n' | nc -U hms.sock
+//
+// A single poll() loop accepts connections, reads requests and writes
+// responses. The requests a client has sent by the time the loop gets to it
+// go to one of the executor threads, which runs them under the table locks
+// they need and hands the responses back through a pipe the loop watches.
+// A client has at most one batch in flight, so its requests still run in
+// order, while different clients' commands run at once: a writer waiting
+// for its log sync holds up neither the loop nor the clients using other
+// tables, and writers of different tables share one sync. Queries within a batch run
+// on the worker threads (QueryManager::executeBatch). Background
+// checkpoints and compaction go on as in the interactive mode.
+class Server
+{
+private:
+    static const size_t MaxLine = 64 << 10;
+    // Stop reading from a client while this much of its input is unhandled
+    static const size_t MaxPendingInput = 2 * MaxLine;
+    // Requests taken from one client per loop round, so a long pipeline
+    // doesn't hold up everyone else
+    static const int MaxRequestsPerRound = 256;
+    // Stop reading from a client that isn't collecting its responses
+    static const size_t MaxPendingOutput = 1 << 20;
+    // Threads running client requests. Writers spend most of their time
+    // waiting for log syncs, so there are more of them than cores.
+    static const unsigned Executors = 16;
+
+    struct Client
+    {
+        int fd;
+        string input;
+        string output;
+        long requests = 0;
+        bool endOfInput = false;    // the client won't send more
+        bool closing = false;       // "quit" or an oversized line
+        bool broken = false;        // can't be written to any more
+        unique_ptr<BatchRunner> runner;
+
+        // While busy, runner and work belong to an executor. busy and
+        // finished are guarded by Server::lock.
+        bool busy = false;
+        vector<pair<long, string>> work;    // requests with their numbers
+        string finished;                    // responses not yet in output
+    };
+
+    Database& db;
+    string socketPath;
+    int listenFd = -1;
+    vector<unique_ptr<Client>> clients;
+
+    mutex lock;
+    condition_variable posted;
+    deque<Client*> queue;
+    bool stopping = false;
+    vector<thread> executors;
+    int wakeFds[2] = { -1, -1 };        // executors -> loop: responses ready
+
+    static volatile sig_atomic_t& stopRequested()
+    {
+        static volatile sig_atomic_t stop = 0;
+        return stop;
+    }
+
+    static void onSignal(int) { stopRequested() = 1; }
+
+    static bool setNonBlocking(int fd)
+    {
+        int flags = ::fcntl(fd, F_GETFL, 0);
+        return flags != -1 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    bool listen()
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path))
+        {
+            cout << "Error: socket path " << socketPath << " is too long!\n";
+            return false;
+        }
+        strcpy(addr.sun_path, socketPath.c_str());
+
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd == -1)
+        {
+            cout << "Error: cannot create socket!\n";
+            return false;
+        }
+
+        // A socket file left by a server that didn't shut down cleanly
+        ::unlink(socketPath.c_str());
+        if (::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listenFd, 64) != 0 ||
+            !setNonBlocking(listenFd))
+        {
+            cout << "Error: cannot listen on " << socketPath << "!\n";
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    void accept()
+    {
+        while (true)
+        {
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd == -1) return;
+            if (!setNonBlocking(fd))
+            {
+                ::close(fd);
+                continue;
+            }
+            unique_ptr<Client> client(new Client);
+            client->fd = fd;
+            client->runner.reset(new BatchRunner(db));
+            clients.push_back(move(client));
+        }
+    }
+
+    // What the client has sent so far, up to MaxPendingInput unhandled;
+    // false once it hung up
+    static bool receive(Client& c)
+    {
+        char buffer[16 << 10];
+        while (c.input.size() < MaxPendingInput)
+        {
+            ssize_t n = ::recv(c.fd, buffer, sizeof(buffer), 0);
+            if (n > 0)
+            {
+                c.input.append(buffer, n);
+                continue;
+            }
+            if (n == 0) return false;
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        return true;
+    }
+
+    // Something for handle(): a complete line, or one already too long
+    static bool hasRequest(const Client& c)
+    {
+        return !c.closing && (c.input.find('\n') != string::npos || c.input.size() > MaxLine);
+    }
+
+    // Take the responses an executor has finished. False while the client
+    // has a batch in flight.
+    bool collect(Client& c)
+    {
+        lock_guard<mutex> hold(lock);
+        if (c.busy) return false;
+        c.output += c.finished;
+        c.finished.clear();
+        return true;
+    }
+
+    // Hand the complete lines in c.input, up to MaxRequestsPerRound, to an
+    // executor. Only called while the client isn't busy.
+    void handle(Client& c)
+    {
+        size_t start = 0, end;
+        int taken = 0;
+        while (!c.closing && taken++ < MaxRequestsPerRound && (end = c.input.find('\n', start)) != string::npos)
+        {
+            string line = c.input.substr(start, end - start);
+            start = end + 1;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line == "quit")
+                c.closing = true;
+            else
+                c.work.push_back({ ++c.requests, line });
+        }
+        c.input.erase(0, start);
+
+        if (!c.work.empty())
+        {
+            lock_guard<mutex> hold(lock);
+            c.busy = true;
+            queue.push_back(&c);
+            posted.notify_one();
+        }
+        // Checked once the requests before it have been answered, so the
+        // response stays in order
+        else if (!c.closing && c.input.size() > MaxLine && c.input.find('\n') == string::npos)
+        {
+            c.output += to_string(++c.requests) + "\terr\t\tLine too long.\n";
+            c.closing = true;
+        }
+    }
+
+    void runExecutor()
+    {
+        unique_lock<mutex> hold(lock);
+        while (true)
+        {
+            posted.wait(hold, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+
+            Client& c = *queue.front();
+            queue.pop_front();
+            hold.unlock();
+
+            ostringstream out;
+            for (const auto& request : c.work)
+                c.runner->feed(request.second, request.first, out);
+            c.runner->flush(out);
+            c.work.clear();
+
+            hold.lock();
+            c.finished += out.str();
+            c.busy = false;
+            char byte = 0;
+            ssize_t ignored = ::write(wakeFds[1], &byte, 1);    // full pipe: a wakeup is pending anyway
+            (void)ignored;
+        }
+    }
+
+    bool startExecutors()
+    {
+        if (::pipe(wakeFds) != 0 || !setNonBlocking(wakeFds[0]) || !setNonBlocking(wakeFds[1]))
+        {
+            cout << "Error: cannot create wakeup pipe!\n";
+            return false;
+        }
+        stopping = false;
+        for (unsigned i = 0; i < Executors; ++i)
+            executors.emplace_back(&Server::runExecutor, this);
+        return true;
+    }
+
+    // Lets the executors finish the requests already handed to them
+    void stopExecutors()
+    {
+        {
+            lock_guard<mutex> hold(lock);
+            stopping = true;
+        }
+        posted.notify_all();
+        for (thread& t : executors)
+            t.join();
+        executors.clear();
+    }
+
+    // Write what the socket takes; false if the client is gone
+    static bool send(Client& c)
+    {
+        while (!c.output.empty())
+        {
+            ssize_t n = ::send(c.fd, c.output.data(), c.output.size(), MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                c.output.erase(0, n);
+                continue;
+            }
+            return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+        }
+        return true;
+    }
+
+public:
+    Server(Database& database, const string& path) : db(database), socketPath(path) {}
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    ~Server()
+    {
+        stopExecutors();
+        for (const auto& c : clients)
+            ::close(c->fd);
+        for (int fd : wakeFds)
+            if (fd != -1) ::close(fd);
+        if (listenFd != -1)
+        {
+            ::close(listenFd);
+            ::unlink(socketPath.c_str());
+        }
+    }
+
+    // Serve until SIGINT or SIGTERM
+    bool run()
+    {
+        if (!listen() || !startExecutors()) return false;
+
+        stopRequested() = 0;
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        cout << "Listening on " << socketPath << "\n" << flush;
+
+        vector<pollfd> fds;
+        while (!stopRequested())
+        {
+            fds.clear();
+            fds.push_back({ listenFd, POLLIN, 0 });
+            fds.push_back({ wakeFds[0], POLLIN, 0 });
+            bool backlog = false;
+            for (const auto& c : clients)
+            {
+                bool idle = collect(*c);
+                short events = 0;
+                if (!c->closing && !c->endOfInput && c->input.size() < MaxPendingInput &&
+                    c->output.size() < MaxPendingOutput)
+                    events |= POLLIN;
+                if (!c->output.empty()) events |= POLLOUT;
+                // Left out entirely when there is nothing to wait for, or a
+                // hangup would wake the loop until the client's batch is done
+                fds.push_back({ events ? c->fd : -1, events, 0 });
+                backlog = backlog || (idle && hasRequest(*c) && c->output.size() < MaxPendingOutput);
+            }
+
+            // Wakes up now and then to notice a stop request; doesn't wait
+            // at all while requests left over from the last round remain
+            if (::poll(fds.data(), fds.size(), backlog ? 0 : 1000) < 0)
+            {
+                if (errno == EINTR) continue;
+                cout << "Error: poll failed!\n";
+                break;
+            }
+
+            if (fds[1].revents & POLLIN)
+            {
+                char drain[256];
+                while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {}
+            }
+
+            for (size_t i = 0; i < clients.size(); ++i)
+            {
+                Client& c = *clients[i];
+                if (!c.endOfInput && (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)))
+                {
+                    c.endOfInput = !receive(c);
+                    // The last request may come without its newline
+                    if (c.endOfInput && !c.input.empty() && c.input.back() != '\n')
+                        c.input += '\n';
+                }
+                if (collect(c) && hasRequest(c) && c.output.size() < MaxPendingOutput)
+                    handle(c);
+                c.broken = !send(c);
+            }
+
+            // A client that is done sending still gets the responses to
+            // everything it sent, as long as it keeps reading. One with a
+            // batch in flight stays until the executor is done with it.
+            for (size_t i = clients.size(); i-- > 0;)
+            {
+                Client& c = *clients[i];
+                if (!collect(c)) continue;
+                bool done = c.closing || (c.endOfInput && !hasRequest(c));
+                if (c.broken || (done && c.output.empty()))
+                {
+                    ::close(c.fd);
+                    clients.erase(clients.begin() + i);
+                }
+            }
+
+            if (fds[0].revents & POLLIN)
+                accept();
+        }
+
+        stopExecutors();
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        cout << "Server stopped.\n";
+        return true;
+    }
+};
@@ -0,0 +1,138 @@
+#include "TestSupport.h"
+#include "Server.h"
+
+// The daemon's protocol: pipelined requests are answered in order and see
+// each other's writes, "quit" ends the connection, and an oversized line
+// gets one error response before the server hangs up.
+
+static const char* Socket = "test.sock";
+
+// Send everything, then read responses until the server hangs up
+static vector<string> exchange(const string& requests)
+{
+    vector<string> responses;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, Socket, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        if (fd >= 0) ::close(fd);
+        return responses;
+    }
+
+    // The server may hang up before it has read it all
+    size_t sent = 0;
+    while (sent < requests.size())
+    {
+        ssize_t n = ::send(fd, requests.data() + sent, requests.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += (size_t)n;
+    }
+    ::shutdown(fd, SHUT_WR);
+
+    string data;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = ::read(fd, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, (size_t)n);
+    ::close(fd);
+
+    istringstream lines(data);
+    string line;
+    while (getline(lines, line))
+        responses.push_back(line);
+    return responses;
+}
+
+static vector<string> fields(const string& response)
+{
+    vector<string> result;
+    istringstream in(response);
+    string field;
+    while (getline(in, field, '\t'))
+        result.push_back(field);
+    return result;
+}
+
+// Responses numbered 1..n, in order, all with the given status
+static bool numbered(const vector<string>& responses, size_t n, const string& status)
+{
+    if (responses.size() != n) return false;
+    for (size_t i = 0; i < n; ++i)
+    {
+        vector<string> f = fields(responses[i]);
+        if (f.size() < 2 || f[0] != to_string(i + 1) || f[1] != status)
+            return false;
+    }
+    return true;
+}
+
+static bool protocolTests()
+{
+    bool ok = true;
+
+    // A write and the query after it in one pipeline, then many reads.
+    // Responses carry the line number, as in a batch script.
+    const int Reads = 300;
+    string requests = "add-doctor|Piped Doctor|Street\n"
+                      "query|Select Doctor Name from Doctors where Doctor Name='Piped Doctor';\n";
+    for (int i = 0; i < Reads; ++i)
+        requests += "doctor|" + IdSequence::formatID(i % 20 + 1) + "\n";
+    requests += "# comments and blank lines get no response\n\n";
+    vector<string> responses = exchange(requests + "quit\n");
+    ok = check(numbered(responses, Reads + 2, "ok"), "pipelined responses come back in order") && ok;
+    ok = check(responses.size() > 1 && responses[1].find("Piped Doctor") != string::npos,
+               "a query sees the write pipelined before it") && ok;
+
+    // Nothing after "quit" runs
+    responses = exchange("doctor|01\nquit\nadd-doctor|After Quit|Street\n");
+    ok = check(numbered(responses, 1, "ok"), "quit ends the connection") && ok;
+    responses = exchange("query|Select Doctor Name from Doctors where Doctor Name='After Quit';\n");
+    ok = check(responses.size() == 1 && responses[0].find("After Quit") == string::npos,
+               "requests after quit are not run") && ok;
+
+    // The requests before an oversized line are answered, then it gets an
+    // error and the connection closes. Well past MaxLine (64 KiB).
+    responses = exchange("doctor|01\n" + string(1 << 20, 'x') + "\ndoctor|02\n");
+    ok = check(responses.size() == 2 && numbered({ responses[0] }, 1, "ok") &&
+               responses[1] == "2\terr\t\tLine too long.", "a line past MaxLine is refused") && ok;
+
+    // The server still takes new connections afterwards
+    ok = check(numbered(exchange("doctor|02\n"), 1, "ok"), "server alive after a refused line") && ok;
+    return ok;
+}
+
+int main()
+{
+    filesystem::path dir = enterScratch("server");
+    DatasetSpec spec;
+    spec.doctors = 20;
+    spec.appointments = 20;
+    spec.deletedDoctors = 0;
+    DatasetGenerator(spec).generate();
+
+    NullBuffer null;
+    streambuf* saved = cout.rdbuf(&null);
+    bool ok = true;
+    {
+        Database db("AppointmentsIndexfile.idx", "DocIndexFile.idx");
+        db.open();
+        Server server(db, Socket);
+        bool served = false;
+        thread loop([&] { served = server.run(); });
+
+        for (int i = 0; i < 500 && !filesystem::exists(Socket); ++i)
+            this_thread::sleep_for(chrono::milliseconds(10));
+        ok = check(filesystem::exists(Socket), "server listening") && protocolTests() && ok;
+
+        ::kill(::getpid(), SIGTERM);
+        loop.join();
+        ok = check(served, "server stopped cleanly") && ok;
+        db.close();
+    }
+    cout.rdbuf(saved);
+
+    leaveScratch(dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,4727 @@
+// Storage layer: record files, write-ahead log, primary and secondary
+// indexes, free-space management and the Database that owns them.
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <string>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <queue>
+#include <memory>
+#include <cstring>
+#include <string_view>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <iomanip>
+#include <cmath>
+#include <list>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+struct IndexEntry
+{
+    string id;
+    long offset;
+};
+
+// ====================== Statistics ======================
+// Latency histogram in nanoseconds. Values below 16 get a bucket each;
+// above that every power of two is split into 16 linear sub-buckets, so
+// a percentile is off by at most 1/16 of its value. Counts are relaxed
+// atomics: any thread can record without a lock.
+class LatencyHistogram
+{
+private:
+    static const int SubBits = 4;
+    static const int SubBuckets = 1 << SubBits;
+    static const int Buckets = (64 - SubBits + 1) * SubBuckets;
+
+    atomic<uint64_t> counts[Buckets] = {};
+    atomic<uint64_t> total{ 0 };
+    atomic<uint64_t> sum{ 0 };
+    atomic<uint64_t> maximum{ 0 };
+
+    static int bucketOf(uint64_t ns)
+    {
+        if (ns < (uint64_t)SubBuckets) return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        int shift = msb - SubBits;
+        return ((shift + 1) << SubBits) + (int)((ns >> shift) & (SubBuckets - 1));
+    }
+
+    static uint64_t lowerBound(int bucket)
+    {
+        if (bucket < SubBuckets) return bucket;
+        int shift = (bucket >> SubBits) - 1;
+        return (uint64_t)(SubBuckets + (bucket & (SubBuckets - 1))) << shift;
+    }
+
+public:
+    void record(uint64_t ns)
+    {
+        counts[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(ns, memory_order_relaxed);
+        uint64_t seen = maximum.load(memory_order_relaxed);
+        while (ns > seen && !maximum.compare_exchange_weak(seen, ns, memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    uint64_t max() const { return maximum.load(memory_order_relaxed); }
+
+    double mean() const
+    {
+        uint64_t n = count();
+        return n ? (double)sum.load(memory_order_relaxed) / n : 0;
+    }
+
+    // Upper edge of the bucket holding the p-th quantile (0 < p <= 1)
+    uint64_t percentile(double p) const
+    {
+        uint64_t n = count();
+        if (n == 0) return 0;
+        uint64_t rank = (uint64_t)ceil(p * n);
+        if (rank == 0) rank = 1;
+
+        uint64_t seen = 0;
+        for (int b = 0; b < Buckets; ++b)
+        {
+            seen += counts[b].load(memory_order_relaxed);
+            if (seen >= rank)
+                return min(max(), b + 1 < Buckets ? lowerBound(b + 1) - 1 : max());
+        }
+        return max();
+    }
+};
+
+// Process-wide instrumentation: a latency histogram per hot operation and
+// I/O counters. Record reads from the mapped data files count as seeks and
+// bytes read; positioned writes (log apply, B+ tree pages) as seeks and
+// bytes written; full scans for rebuilds as bytes read. Shown by the
+// statistics menu command and written to stats.json at exit.
+class Stats
+{
+public:
+    enum Op
+    {
+        IndexLookup, RecordRead, IndexRebuild,
+        InsertDoctor, InsertAppointment, UpdateDoctor, UpdateAppointment,
+        DeleteDoctor, DeleteAppointment, Query,
+        OpCount
+    };
+
+    enum Counter
+    {
+        FileOpens, Seeks, BytesRead, BytesWritten,
+        CacheHits, CacheMisses, CacheEvictions, CacheInvalidations,
+        Fsyncs, LogCommits,
+        CounterCount
+    };
+
+private:
+    LatencyHistogram ops[OpCount];
+    atomic<uint64_t> counters[CounterCount] = {};
+
+    static const char* opName(int op)
+    {
+        static const char* names[OpCount] = {
+            "index_lookup", "record_read", "index_rebuild",
+            "insert_doctor", "insert_appointment", "update_doctor", "update_appointment",
+            "delete_doctor", "delete_appointment", "query"
+        };
+        return names[op];
+    }
+
+    static const char* counterName(int counter)
+    {
+        static const char* names[CounterCount] = {
+            "file_opens", "seeks", "bytes_read", "bytes_written",
+            "cache_hits", "cache_misses", "cache_evictions", "cache_invalidations",
+            "fsyncs", "log_commits"
+        };
+        return names[counter];
+    }
+
+    Stats() = default;
+
+public:
+    static Stats& get()
+    {
+        static Stats stats;
+        return stats;
+    }
+
+    void record(Op op, uint64_t ns) { ops[op].record(ns); }
+
+    void add(Counter counter, uint64_t n = 1) { counters[counter].fetch_add(n, memory_order_relaxed); }
+
+    uint64_t counter(Counter counter) const { return counters[counter].load(memory_order_relaxed); }
+
+    double cacheHitRatio() const
+    {
+        uint64_t hits = counters[CacheHits].load(memory_order_relaxed);
+        uint64_t lookups = hits + counters[CacheMisses].load(memory_order_relaxed);
+        return lookups ? (double)hits / lookups : 0;
+    }
+
+    // An open plus a full sequential read of the file (rebuild scans)
+    void addScan(const string& file)
+    {
+        error_code ec;
+        uintmax_t size = filesystem::file_size(file, ec);
+        add(FileOpens);
+        if (!ec) add(BytesRead, size);
+    }
+
+    // Records the lifetime of the enclosing scope under one operation
+    class Timer
+    {
+    private:
+        Op op;
+        chrono::steady_clock::time_point start;
+
+    public:
+        explicit Timer(Op o) : op(o), start(chrono::steady_clock::now()) {}
+        ~Timer()
+        {
+            auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            Stats::get().record(op, (uint64_t)ns);
+        }
+    };
+
+    void print(ostream& out) const
+    {
+        out << "--- Operation Latency (microseconds) ---\n";
+        out << left << setw(20) << "operation" << right << setw(10) << "count" << setw(10) << "mean"
+            << setw(10) << "p50" << setw(10) << "p99" << setw(10) << "max" << "\n";
+        out << fixed << setprecision(1);
+        for (int i = 0; i < OpCount; ++i)
+        {
+            const LatencyHistogram& h = ops[i];
+            out << left << setw(20) << opName(i) << right << setw(10) << h.count()
+                << setw(10) << h.mean() / 1000.0
+                << setw(10) << h.percentile(0.50) / 1000.0
+                << setw(10) << h.percentile(0.99) / 1000.0
+                << setw(10) << h.max() / 1000.0 << "\n";
+        }
+        out << defaultfloat << setprecision(6);
+
+        out << "--- I/O ---\n";
+        for (int i = 0; i < CounterCount; ++i)
+            out << left << setw(20) << counterName(i) << right << setw(14)
+                << counters[i].load(memory_order_relaxed) << "\n";
+        out << left << setw(20) << "index_rebuilds" << right << setw(14) << ops[IndexRebuild].count() << "\n";
+        out << left << setw(20) << "cache_hit_ratio" << right << setw(14) << fixed << setprecision(3)
+            << cacheHitRatio() << defaultfloat << setprecision(6) << "\n";
+    }
+
+    // Latencies in nanoseconds
+    bool dumpJson(const string& file) const
+    {
+        ofstream out(file, ios::trunc);
+        if (!out) return false;
+
+        out << "{\n  \"operations\": {\n";
+        for (int i = 0; i < OpCount; ++i)
+        {
+            const LatencyHistogram& h = ops[i];
+            out << "    \"" << opName(i) << "\": { \"count\": " << h.count()
+                << ", \"mean_ns\": " << (uint64_t)h.mean()
+                << ", \"p50_ns\": " << h.percentile(0.50)
+                << ", \"p99_ns\": " << h.percentile(0.99)
+                << ", \"max_ns\": " << h.max() << " }"
+                << (i + 1 < OpCount ? "," : "") << "\n";
+        }
+        out << "  },\n  \"io\": {\n";
+        for (int i = 0; i < CounterCount; ++i)
+            out << "    \"" << counterName(i) << "\": " << counters[i].load(memory_order_relaxed) << ",\n";
+        out << "    \"index_rebuilds\": " << ops[IndexRebuild].count() << ",\n";
+        out << "    \"cache_hit_ratio\": " << cacheHitRatio() << "\n  }\n}\n";
+        return (bool)out;
+    }
+};
+
+// ====================== Durable Files ======================
+// fdatasync, counted
+inline bool syncFile(int fd)
+{
+    Stats::get().add(Stats::Fsyncs);
+    return ::fdatasync(fd) == 0;
+}
+
+// fsync a file (or directory) by name, e.g. after an ofstream wrote it
+inline bool syncPath(const string& path, bool directory = false)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | (directory ? O_DIRECTORY : 0));
+    if (fd == -1) return false;
+    Stats::get().add(Stats::Fsyncs);
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// Put a fully written temp file in place of target. The data is synced
+// before the rename and the directory entry after it, so after a crash
+// target is the old file or the complete new one, never a partial one.
+inline bool replaceFile(const string& tmp, const string& target)
+{
+    if (!syncPath(tmp)) return false;
+    error_code ec;
+    filesystem::rename(tmp, target, ec);
+    if (ec) return false;
+    string dir = filesystem::path(target).parent_path().string();
+    return syncPath(dir.empty() ? "." : dir, true);
+}
+
+// FNV-1a, for checksums of log records and journaled pages
+inline uint64_t checksum(const char* p, size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; i++)
+    {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// ====================== Parallel Loops ======================
+// Worker threads to use when the caller asks for 0: one per core
+inline unsigned workerCount(unsigned requested)
+{
+    return requested > 0 ? requested : max(1u, thread::hardware_concurrency());
+}
+
+// Threads kept for the life of the process, so a parallel loop (a query
+// batch, an index build) doesn't start and join threads every time. Each
+// loop is a job: its caller works on it as worker 0 and idle pool threads
+// join in as workers 1, 2, ... up to the job's limit. Several jobs can be
+// in flight at once (query batches of different clients); a thread picks
+// up the oldest one that still takes helpers. The pool grows to the
+// largest worker count asked for and never shrinks.
+class WorkerPool
+{
+private:
+    struct Job
+    {
+        size_t count;
+        unsigned workers;
+        const function<void(size_t, unsigned)>* task;
+        atomic<size_t> next{ 0 };
+        unsigned joined = 1;            // the caller is worker 0
+        unsigned running = 0;           // helpers still working on it
+    };
+
+    mutex lock;
+    condition_variable posted;
+    condition_variable left;
+    deque<Job*> jobs;                   // jobs that still take helpers
+    vector<thread> threads;
+    bool stopping = false;
+
+    static void work(Job& job, unsigned worker)
+    {
+        for (size_t i = job.next++; i < job.count; i = job.next++)
+            (*job.task)(i, worker);
+    }
+
+    void runThread()
+    {
+        unique_lock<mutex> hold(lock);
+        while (true)
+        {
+            posted.wait(hold, [&] { return stopping || !jobs.empty(); });
+            if (stopping) return;
+
+            Job* job = jobs.front();
+            unsigned worker = job->joined++;
+            if (job->joined == job->workers)
+                jobs.pop_front();
+            job->running++;
+            hold.unlock();
+
+            work(*job, worker);
+
+            hold.lock();
+            job->running--;
+            left.notify_all();
+        }
+    }
+
+    WorkerPool() = default;
+
+public:
+    ~WorkerPool()
+    {
+        {
+            lock_guard<mutex> hold(lock);
+            stopping = true;
+        }
+        posted.notify_all();
+        for (thread& t : threads)
+            t.join();
+    }
+
+    static WorkerPool& get()
+    {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    // task(i, worker) for every i in [0, count), worker < workers
+    void run(size_t count, unsigned workers, const function<void(size_t, unsigned)>& task)
+    {
+        Job job;
+        job.count = count;
+        job.workers = workers;
+        job.task = &task;
+
+        if (workers > 1)
+        {
+            lock_guard<mutex> hold(lock);
+            while (threads.size() < workers - 1)
+                threads.emplace_back(&WorkerPool::runThread, this);
+            jobs.push_back(&job);
+        }
+        posted.notify_all();
+
+        work(job, 0);
+
+        if (workers > 1)
+        {
+            // Nothing is left to hand out; wait for the helpers still on it
+            unique_lock<mutex> hold(lock);
+            auto it = find(jobs.begin(), jobs.end(), &job);
+            if (it != jobs.end())
+                jobs.erase(it);
+            left.wait(hold, [&] { return job.running == 0; });
+        }
+    }
+};
+
+// Runs task(i, worker) for every i in [0, count) on up to `workers`
+// threads (0 = one per core), the calling thread included, taken from the
+// WorkerPool; worker is the running thread's number, below
+// workerCount(workers). Tasks are handed out one at a time, so uneven
+// tasks still keep every thread busy.
+template <class F>
+void parallelFor(size_t count, unsigned workers, F task)
+{
+    workers = (unsigned)min<size_t>(workerCount(workers), count);
+    if (workers == 0) return;
+
+    function<void(size_t, unsigned)> run = [&](size_t i, unsigned worker) { task(i, worker); };
+    WorkerPool::get().run(count, workers, run);
+}
+
+// ====================== Shared Record File Handles ======================
+// One long-lived handle per data file, shared by every index and manager.
+// The file is mapped read-only (MAP_SHARED, so in-place writes through
+// fstream are visible immediately) and records are handed out as
+// string_view slices of the mapping: a lookup is a pointer offset plus a
+// memchr for the line end, with no syscall or allocation per record.
+//
+// Safe for concurrent readers: growing the mapping is serialized by
+// mapLock, and readers that already see enough bytes never take it.
+class RecordFile
+{
+private:
+    static const size_t MinMapping = 1 << 20;
+
+    string path;
+    int fd = -1;
+    mutex mapLock;
+
+    // The mapping reserves address space beyond EOF so appends usually only
+    // need knownSize bumped; pages past EOF are never touched. base is
+    // published before knownSize, so a reader that loads knownSize first
+    // gets a mapping that covers it.
+    atomic<const char*> base{ nullptr };
+    size_t capacity = 0;
+    atomic<size_t> knownSize{ 0 };
+
+    // Mappings replaced after the file outgrew them. Kept alive so views
+    // handed out earlier stay valid.
+    vector<pair<void*, size_t>> retired;
+
+    explicit RecordFile(const string& filePath) : path(filePath) {
+        ensureOpen();
+    }
+
+    // The file may not exist yet when the handle is first requested
+    bool ensureOpen()
+    {
+        lock_guard<mutex> hold(mapLock);
+        return openLocked();
+    }
+
+    bool openLocked()
+    {
+        if (fd == -1)
+        {
+            fd = ::open(path.c_str(), O_RDONLY);
+            if (fd != -1)
+                Stats::get().add(Stats::FileOpens);
+        }
+        return fd != -1;
+    }
+
+    // Make sure bytes [0, end) are mapped and return the mapping with the
+    // size it covers. Only asks the kernel for the current file size when a
+    // caller wants bytes we haven't seen yet.
+    bool ensureMapped(size_t end, const char*& data, size_t& size)
+    {
+        size = knownSize.load(memory_order_acquire);
+        data = base.load(memory_order_relaxed);
+        if (end <= size) return true;
+
+        lock_guard<mutex> hold(mapLock);
+        if (!openLocked()) return false;
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) return false;
+        size = (size_t)st.st_size;
+
+        if (size > capacity)
+        {
+            size_t newCapacity = max(size * 2, MinMapping);
+            void* p = ::mmap(nullptr, newCapacity, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) return false;
+            if (base)
+                retired.push_back({ (void*)base.load(), capacity });
+            base.store((const char*)p, memory_order_relaxed);
+            capacity = newCapacity;
+        }
+        knownSize.store(size, memory_order_release);
+        data = base.load(memory_order_relaxed);
+        return end <= size;
+    }
+
+public:
+    RecordFile(const RecordFile&) = delete;
+    RecordFile& operator=(const RecordFile&) = delete;
+
+    ~RecordFile() {
+        if (base) ::munmap((void*)base.load(), capacity);
+        for (auto& m : retired) ::munmap(m.first, m.second);
+        if (fd != -1) ::close(fd);
+    }
+
+    // The process-wide handle for a data file
+    static RecordFile& get(const string& filePath)
+    {
+        static mutex registryLock;
+        static unordered_map<string, unique_ptr<RecordFile>> files;
+        lock_guard<mutex> hold(registryLock);
+        unique_ptr<RecordFile>& handle = files[filePath];
+        if (!handle)
+            handle.reset(new RecordFile(filePath));
+        return *handle;
+    }
+
+    bool isOpen() { return ensureOpen(); }
+
+    // The file was truncated: forget the size we knew, so nothing past the
+    // new end is handed out
+    void refresh()
+    {
+        lock_guard<mutex> hold(mapLock);
+        knownSize.store(0, memory_order_release);
+    }
+
+    // Zero-copy view of the record (line) starting at offset, without its
+    // line terminator. Empty if offset is at/after EOF.
+    string_view view(long offset)
+    {
+        const char* data;
+        size_t size;
+        if (offset < 0 || !ensureMapped((size_t)offset + 1, data, size))
+            return {};
+
+        const char* start = data + offset;
+        const void* nl = memchr(start, '\n', size - offset);
+        // A record without a terminator may still be growing: re-check once
+        if (!nl && ensureMapped(size + 1, data, size))
+        {
+            start = data + offset;
+            nl = memchr(start, '\n', size - offset);
+        }
+
+        size_t len = nl ? (const char*)nl - start : size - offset;
+
+        // Remove carriage return if present (Windows line endings)
+        if (len > 0 && start[len - 1] == '\r')
+            len--;
+        Stats::get().add(Stats::Seeks);
+        Stats::get().add(Stats::BytesRead, len);
+        return string_view(start, len);
+    }
+
+    // Raw byte at offset, -1 at/after EOF
+    int byteAt(long offset)
+    {
+        const char* data;
+        size_t size;
+        if (offset < 0 || !ensureMapped((size_t)offset + 1, data, size))
+            return -1;
+        return (unsigned char)data[offset];
+    }
+
+    // Copying variant for callers that keep or modify the record.
+    // Returns false if the file can't be read or offset is at/after EOF.
+    bool readLine(long offset, string& line)
+    {
+        line.clear();
+        if (byteAt(offset) == -1)
+            return false;
+        line.assign(view(offset));
+        return true;
+    }
+
+    string readLine(long offset)
+    {
+        return string(view(offset));
+    }
+};
+
+// ====================== Record Cache ======================
+// A record as it was read from a data file
+struct CachedRecord
+{
+    string line;        // without the line terminator
+    bool deleted;       // tombstoned ('*' after the length header)
+};
+
+// Size-bounded LRU of records keyed by data file and offset, in front of
+// the record reads of the indexes and lookups. Every data-file write goes
+// through WriteAheadLog::apply, which calls invalidate() with the exact
+// byte range, so updates, tombstones, hole reuse and compaction moves drop
+// precisely the records they overlap. Records are handed out as shared
+// pointers, so an eviction never pulls one out from under a caller.
+//
+// Split into shards by offset, each with its own lock and its share of the
+// budget, so concurrent readers rarely wait on each other.
+class RecordCache
+{
+public:
+    static const size_t DefaultBudget = 8 << 20;
+
+private:
+    static const size_t ShardCount = 16;
+
+    struct Entry
+    {
+        string file;
+        long offset;
+        long span;      // bytes on disk, line terminator included
+        shared_ptr<const CachedRecord> record;
+    };
+    typedef list<Entry> Lru;        // most recently used first
+    typedef map<long, Lru::iterator> FileEntries;
+
+    struct Shard
+    {
+        mutex lock;
+        size_t used = 0;
+        Lru lru;
+        // Ordered by offset, so a write finds every record it overlaps
+        unordered_map<string, FileEntries> byFile;
+    };
+
+    Shard shards[ShardCount];
+    atomic<size_t> budget{ DefaultBudget };
+    // Bumped by every invalidation; a read that raced one isn't cached
+    atomic<uint64_t> generation{ 0 };
+
+    Shard& shardOf(long offset)
+    {
+        return shards[((uint64_t)offset * 0x9E3779B97F4A7C15ULL) >> 60];
+    }
+
+    static size_t costOf(const Entry& e)
+    {
+        // Payload plus a rough allowance for the list and map nodes
+        return e.record->line.capacity() + e.file.capacity() + sizeof(Entry) + sizeof(CachedRecord) + 96;
+    }
+
+    static FileEntries::iterator drop(Shard& shard, FileEntries& entries, FileEntries::iterator it)
+    {
+        shard.used -= costOf(*it->second);
+        shard.lru.erase(it->second);
+        return entries.erase(it);
+    }
+
+    void evict(Shard& shard)
+    {
+        size_t limit = budget / ShardCount;
+        while (shard.used > limit && !shard.lru.empty())
+        {
+            const Entry& oldest = shard.lru.back();
+            FileEntries& entries = shard.byFile[oldest.file];
+            drop(shard, entries, entries.find(oldest.offset));
+            Stats::get().add(Stats::CacheEvictions);
+        }
+    }
+
+    RecordCache() = default;
+
+public:
+    static RecordCache& get()
+    {
+        static RecordCache cache;
+        return cache;
+    }
+
+    void setBudget(size_t bytes)
+    {
+        budget = bytes;
+        for (Shard& shard : shards)
+        {
+            lock_guard<mutex> hold(shard.lock);
+            evict(shard);
+        }
+    }
+
+    // The record starting at offset, or nullptr at/after EOF
+    shared_ptr<const CachedRecord> read(const string& file, long offset)
+    {
+        if (offset < 0) return nullptr;
+
+        Shard& shard = shardOf(offset);
+        uint64_t seen;
+        {
+            lock_guard<mutex> hold(shard.lock);
+            auto f = shard.byFile.find(file);
+            if (f != shard.byFile.end())
+            {
+                auto it = f->second.find(offset);
+                if (it != f->second.end())
+                {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                    Stats::get().add(Stats::CacheHits);
+                    return it->second->record;
+                }
+            }
+            seen = generation;
+        }
+
+        Stats::get().add(Stats::CacheMisses);
+        RecordFile& data = RecordFile::get(file);
+        string_view view = data.view(offset);
+        if (view.empty()) return nullptr;
+
+        long span = (long)view.size();
+        if (data.byteAt(offset + span) == '\r') span++;
+        if (data.byteAt(offset + span) == '\n') span++;
+        auto record = make_shared<const CachedRecord>(CachedRecord{ string(view), view.size() > 3 && view[3] == '*' });
+
+        lock_guard<mutex> hold(shard.lock);
+        FileEntries& entries = shard.byFile[file];
+        if (generation != seen || entries.count(offset))
+            return record;
+        shard.lru.push_front({ file, offset, span, record });
+        entries[offset] = shard.lru.begin();
+        shard.used += costOf(shard.lru.front());
+        evict(shard);
+        return record;
+    }
+
+    // Bytes [offset, offset + length) of file changed
+    void invalidate(const string& file, long offset, long length)
+    {
+        generation++;
+        long end = length > numeric_limits<long>::max() - offset ? numeric_limits<long>::max() : offset + length;
+        for (Shard& shard : shards)
+        {
+            lock_guard<mutex> hold(shard.lock);
+            auto f = shard.byFile.find(file);
+            if (f == shard.byFile.end()) continue;
+
+            FileEntries& entries = f->second;
+            auto it = entries.lower_bound(offset);
+            if (it != entries.begin())
+            {
+                auto before = prev(it);
+                if (before->first + before->second->span > offset)
+                {
+                    drop(shard, entries, before);
+                    Stats::get().add(Stats::CacheInvalidations);
+                }
+            }
+            while (it != entries.end() && it->first < end)
+            {
+                it = drop(shard, entries, it);
+                Stats::get().add(Stats::CacheInvalidations);
+            }
+        }
+    }
+
+    // file was cut to length bytes
+    void truncate(const string& file, long length)
+    {
+        invalidate(file, length, numeric_limits<long>::max());
+    }
+};
+
+// ====================== Write-Ahead Log ======================
+// Every data-file change made by Insert, UpdateManager and DeleteManager
+// (including the free-space bookkeeping they trigger) is collected in a
+// transaction between begin() and commit(). Each thread builds its own
+// transaction. commit() queues it for the log as one record, in commit order
+// under Database's writer lock. The flusher thread writes and fsyncs the
+// queued records, and only then applies their bytes to the data files, in
+// the same order, so no data-file byte ever reaches the disk ahead of its
+// log record. waitDurable() blocks until that is done. Database's TableLocks
+// calls it after letting go of the writer lock but before the table locks,
+// so nobody reads a change that isn't durable yet, while writers of other
+// tables commit behind the fsync in progress and share the next one (group
+// commit). begin() waits for the thread's previous transaction, so the
+// files a transaction reads already hold everything it committed before.
+//
+// Indexes are no longer saved per mutation. Database checkpoints them in the
+// background, after syncing the data files, and then truncates the log.
+// After a crash, recover() re-applies the transactions still in the log.
+//
+// Log record (one per transaction):
+//     uint32 magic, uint32 body length, uint64 FNV-1a of the body, body
+//     body: per write  uint16 name length, name, int64 offset,
+//                      uint32 byte count, bytes
+//     (a byte count of TruncateMarker truncates the file to `offset`)
+// A torn or corrupt tail record ends the replay.
+class WriteAheadLog
+{
+private:
+    static const uint32_t RecordMagic = 0x4e585457;   // "WTXN"
+    static const uint32_t TruncateMarker = 0xffffffff;
+
+    struct Write
+    {
+        string file;
+        long offset;
+        string bytes;
+        bool truncate = false;
+    };
+
+    string logfile;
+    int logFd = -1;
+
+    // One thread's transaction: the writes since begin(), and once it has
+    // committed, the record it still has to wait for
+    struct Transaction
+    {
+        bool active = false;
+        vector<Write> writes;
+        uint64_t seq = 0;
+    };
+
+    // Entries are only touched by their own thread; the map itself is
+    // guarded by byThreadLock
+    mutex byThreadLock;
+    unordered_map<thread::id, Transaction> byThread;
+
+    // Group commit state, shared with the flusher thread
+    mutex queueLock;
+    condition_variable queued;
+    condition_variable synced;
+    string queue;               // committed records not written yet
+    vector<vector<Write>> queuedWrites;     // their writes, in the same order
+    uint64_t queuedSeq = 0;     // last transaction put in the queue
+    uint64_t syncedSeq = 0;     // last transaction synced and applied
+    uint64_t failedFrom = 1;    // the last batch that couldn't be synced or applied
+    uint64_t failedTo = 0;
+    size_t logBytes = 0;        // log size since the last truncate
+    size_t logRecords = 0;      // transactions since the last truncate
+    bool stopping = false;
+    thread flusher;
+
+    // Data-file descriptors, shared by the flusher and checkpoints
+    mutex applyLock;
+    unordered_map<string, int> dataFds;
+
+    template <class T>
+    static void put(string& out, T value)
+    {
+        out.append((const char*)&value, sizeof(value));
+    }
+
+    template <class T>
+    static bool get(const string& in, size_t& pos, T& value)
+    {
+        if (pos + sizeof(value) > in.size()) return false;
+        memcpy(&value, in.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    static bool writeFully(int fd, const char* p, size_t n, off_t offset = -1)
+    {
+        Stats::get().add(Stats::BytesWritten, n);
+        if (offset >= 0)
+            Stats::get().add(Stats::Seeks);
+        while (n > 0)
+        {
+            ssize_t done = offset < 0 ? ::write(fd, p, n) : ::pwrite(fd, p, n, offset);
+            if (done <= 0) return false;
+            p += done;
+            n -= done;
+            if (offset >= 0) offset += done;
+        }
+        return true;
+    }
+
+    Transaction& current()
+    {
+        lock_guard<mutex> lock(byThreadLock);
+        return byThread[this_thread::get_id()];
+    }
+
+    // Caller holds applyLock
+    int dataFd(const string& file)
+    {
+        int& fd = dataFds[file];
+        if (fd <= 0)
+        {
+            fd = ::open(file.c_str(), O_WRONLY | O_CREAT, 0644);
+            if (fd > 0)
+                Stats::get().add(Stats::FileOpens);
+        }
+        return fd;
+    }
+
+    bool apply(const vector<Write>& batch)
+    {
+        lock_guard<mutex> lock(applyLock);
+        bool ok = true;
+        for (const Write& w : batch)
+        {
+            int fd = dataFd(w.file);
+            if (w.truncate)
+            {
+                ok = fd > 0 && ::ftruncate(fd, w.offset) == 0 && ok;
+                RecordFile::get(w.file).refresh();
+                RecordCache::get().truncate(w.file, w.offset);
+            }
+            else
+            {
+                ok = fd > 0 && writeFully(fd, w.bytes.data(), w.bytes.size(), w.offset) && ok;
+                RecordCache::get().invalidate(w.file, w.offset, (long)w.bytes.size());
+            }
+        }
+        return ok;
+    }
+
+    static string serialize(const vector<Write>& batch)
+    {
+        string body;
+        for (const Write& w : batch)
+        {
+            put<uint16_t>(body, (uint16_t)w.file.size());
+            body += w.file;
+            put<int64_t>(body, w.offset);
+            put<uint32_t>(body, w.truncate ? TruncateMarker : (uint32_t)w.bytes.size());
+            body += w.bytes;
+        }
+
+        string record;
+        put<uint32_t>(record, RecordMagic);
+        put<uint32_t>(record, (uint32_t)body.size());
+        put<uint64_t>(record, checksum(body.data(), body.size()));
+        return record + body;
+    }
+
+    void runFlusher()
+    {
+        unique_lock<mutex> lock(queueLock);
+        while (true)
+        {
+            queued.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) break;
+
+            string batch;
+            batch.swap(queue);
+            vector<vector<Write>> writes;
+            writes.swap(queuedWrites);
+            uint64_t upTo = queuedSeq;
+            lock.unlock();
+
+            // A batch the log doesn't have is never applied
+            bool ok = writeFully(logFd, batch.data(), batch.size()) && syncFile(logFd);
+            if (ok)
+                for (const vector<Write>& w : writes)
+                    ok = apply(w) && ok;
+
+            lock.lock();
+            if (!ok)
+            {
+                failedFrom = syncedSeq + 1;
+                failedTo = upTo;
+            }
+            syncedSeq = upTo;
+            synced.notify_all();
+        }
+    }
+
+public:
+    explicit WriteAheadLog(const string& file) : logfile(file) {}
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog() { close(); }
+
+    bool open()
+    {
+        if (logFd != -1) return true;
+        logFd = ::open(logfile.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (logFd != -1)
+            Stats::get().add(Stats::FileOpens);
+        if (logFd == -1)
+        {
+            cout << "Error: Cannot open " << logfile << "!\n";
+            return false;
+        }
+        stopping = false;
+        flusher = thread(&WriteAheadLog::runFlusher, this);
+        return true;
+    }
+
+    void close()
+    {
+        if (flusher.joinable())
+        {
+            {
+                lock_guard<mutex> lock(queueLock);
+                stopping = true;
+            }
+            queued.notify_all();
+            flusher.join();
+        }
+        lock_guard<mutex> lock(applyLock);
+        for (auto& f : dataFds)
+            if (f.second > 0) ::close(f.second);
+        dataFds.clear();
+        byThread.clear();
+        if (logFd != -1) ::close(logFd);
+        logFd = -1;
+    }
+
+    // Re-apply every complete transaction in the log to the data files.
+    // Returns how many were replayed; the log itself is kept until the
+    // next checkpoint.
+    long recover()
+    {
+        ifstream in(logfile, ios::binary);
+        if (!in) return 0;
+        string log((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+        long replayed = 0;
+        size_t pos = 0;
+        while (true)
+        {
+            uint32_t magic, length;
+            uint64_t sum;
+            if (!get(log, pos, magic) || magic != RecordMagic ||
+                !get(log, pos, length) || !get(log, pos, sum) ||
+                pos + length > log.size() || checksum(log.data() + pos, length) != sum)
+                break;
+
+            string body = log.substr(pos, length);
+            pos += length;
+
+            vector<Write> batch;
+            size_t at = 0;
+            while (at < body.size())
+            {
+                uint16_t nameLength = 0;
+                int64_t offset = 0;
+                uint32_t count = 0;
+                Write w;
+                if (!get(body, at, nameLength) || at + nameLength > body.size()) break;
+                w.file = body.substr(at, nameLength);
+                at += nameLength;
+                if (!get(body, at, offset) || !get(body, at, count)) break;
+                w.offset = (long)offset;
+                if (count == TruncateMarker)
+                {
+                    w.truncate = true;
+                    batch.push_back(move(w));
+                    continue;
+                }
+                if (at + count > body.size()) break;
+                w.bytes = body.substr(at, count);
+                at += count;
+                batch.push_back(move(w));
+            }
+            apply(batch);
+            replayed++;
+        }
+
+        lock_guard<mutex> lock(queueLock);
+        logBytes = log.size();
+        logRecords = replayed;
+        return replayed;
+    }
+
+    void begin()
+    {
+        Transaction& t = current();
+        if (t.seq != 0)
+        {
+            unique_lock<mutex> lock(queueLock);
+            synced.wait(lock, [&] { return syncedSeq >= t.seq; });
+        }
+        t.active = true;
+        t.writes.clear();
+    }
+
+    // Outside a transaction a write commits on its own
+    void write(const string& file, long offset, const string& bytes)
+    {
+        Transaction& t = current();
+        if (!t.active)
+        {
+            begin();
+            write(file, offset, bytes);
+            commit();
+            return;
+        }
+        t.writes.push_back({ file, offset, bytes });
+    }
+
+    // Cut the file to `length` bytes when the transaction is applied
+    void truncateFile(const string& file, long length)
+    {
+        Transaction& t = current();
+        if (!t.active)
+        {
+            begin();
+            truncateFile(file, length);
+            commit();
+            return;
+        }
+        Write w{ file, length, "" };
+        w.truncate = true;
+        t.writes.push_back(w);
+    }
+
+    // Write at the end of the file as it will be once the transaction's
+    // earlier writes are applied. Returns the offset used.
+    long append(const string& file, const string& bytes)
+    {
+        struct stat st;
+        long end = (::stat(file.c_str(), &st) == 0) ? (long)st.st_size : 0;
+        for (const Write& w : current().writes)
+            if (w.file == file)
+                end = w.truncate ? w.offset : max(end, w.offset + (long)w.bytes.size());
+        write(file, end, bytes);
+        return end;
+    }
+
+    // Queue the transaction for the log; the flusher applies it once the
+    // record is synced. The caller holds the writer lock, so records are
+    // queued in commit order. See waitDurable() for the outcome.
+    void commit()
+    {
+        Transaction& t = current();
+        t.active = false;
+        if (t.writes.empty()) return;
+
+        string record = serialize(t.writes);
+        {
+            lock_guard<mutex> lock(queueLock);
+            queue += record;
+            queuedWrites.push_back(move(t.writes));
+            logBytes += record.size();
+            logRecords++;
+            t.seq = ++queuedSeq;
+        }
+        queued.notify_one();
+        Stats::get().add(Stats::LogCommits);
+        t.writes.clear();
+    }
+
+    void abort()
+    {
+        Transaction& t = current();
+        t.active = false;
+        t.writes.clear();
+    }
+
+    // Wait until the transactions this thread committed are synced to the
+    // log and applied to the data files. Returns false if their batch could
+    // not be logged or applied; the change then isn't in the files (or only
+    // partly), though the in-memory indexes already have it.
+    bool waitDurable()
+    {
+        uint64_t seq;
+        {
+            lock_guard<mutex> lock(byThreadLock);
+            auto it = byThread.find(this_thread::get_id());
+            if (it == byThread.end() || it->second.seq == 0) return true;
+            seq = it->second.seq;
+            if (it->second.active)
+                it->second.seq = 0;
+            else
+                byThread.erase(it);
+        }
+
+        bool durable;
+        {
+            unique_lock<mutex> lock(queueLock);
+            synced.wait(lock, [&] { return syncedSeq >= seq; });
+            durable = seq < failedFrom || seq > failedTo;
+        }
+        if (!durable)
+            cout << "Error: Cannot sync " << logfile << " or apply it, change not saved!\n";
+        return durable;
+    }
+
+    size_t size()
+    {
+        lock_guard<mutex> lock(queueLock);
+        return logBytes;
+    }
+
+    size_t transactions()
+    {
+        lock_guard<mutex> lock(queueLock);
+        return logRecords;
+    }
+
+    // Everything committed so far reaches the disk
+    bool syncDataFiles()
+    {
+        {
+            unique_lock<mutex> lock(queueLock);
+            synced.wait(lock, [&] { return syncedSeq >= queuedSeq; });
+        }
+        lock_guard<mutex> lock(applyLock);
+        bool ok = true;
+        for (auto& f : dataFds)
+            ok = (f.second <= 0 || syncFile(f.second)) && ok;
+        return ok;
+    }
+
+    // Called by a checkpoint once the data files and indexes are on disk.
+    // Records still queued are written first, or they would land in the
+    // log after the cut and be replayed over the checkpoint.
+    void truncate()
+    {
+        unique_lock<mutex> lock(queueLock);
+        synced.wait(lock, [&] { return syncedSeq >= queuedSeq; });
+        if (logFd != -1 && ::ftruncate(logFd, 0) == 0)
+        {
+            syncFile(logFd);
+            logBytes = 0;
+            logRecords = 0;
+        }
+    }
+};
+
+// ====================== Index Delta Log ======================
+// Changes made to an index since its last saved snapshot, one text line per
+// change. Lines go through the write-ahead log as part of the mutation's
+// transaction, so the snapshot plus this file is the index as of the last
+// commit. loadIndex() replays it; it is emptied once a checkpoint has saved
+// the snapshot. Without an attached log nothing is recorded (bulk tools
+// save their snapshot themselves).
+class DeltaLog
+{
+private:
+    string deltafile;
+    WriteAheadLog* wal = nullptr;
+
+public:
+    explicit DeltaLog(const string& file) : deltafile(file) {}
+
+    void attach(WriteAheadLog& log) { wal = &log; }
+
+    void append(const string& line)
+    {
+        if (wal)
+            wal->append(deltafile, line + "\n");
+    }
+
+    // f(line) for each recorded change, oldest first. Returns the count.
+    template <class F>
+    size_t replay(F f)
+    {
+        ifstream in(deltafile, ios::binary);
+        size_t count = 0;
+        string line;
+        while (getline(in, line))
+        {
+            // A log replay after a crash mid-checkpoint can leave a zero-filled gap
+            line.erase(0, line.find_first_not_of('\0'));
+            if (line.empty()) continue;
+            f(line);
+            count++;
+        }
+        return count;
+    }
+
+    void clear()
+    {
+        error_code ec;
+        if (filesystem::file_size(deltafile, ec) > 0 && !ec)
+            filesystem::resize_file(deltafile, 0, ec);
+    }
+};
+
+// Sorts (key, offset) pairs by key, then offset, within a fixed memory
+// budget. Once the buffer outgrows the budget it is sorted and spilled to a
+// run file next to runPrefix; merge() then streams a k-way merge of the runs.
+// Used to build indexes whose entries don't all fit in memory.
+class ExternalSorter
+{
+private:
+    static bool less(const IndexEntry& a, const IndexEntry& b)
+    {
+        return a.id != b.id ? a.id < b.id : a.offset < b.offset;
+    }
+
+    // A sorted stream of entries: a run file, or the sorted buffer of a
+    // sorter. Run file: per entry a uint32 key length, the key bytes, an
+    // int64 offset
+    struct Run
+    {
+        ifstream in;
+        IndexEntry entry;
+        const vector<IndexEntry>* memory = nullptr;
+        size_t pos = 0;
+        const IndexEntry* head = nullptr;
+
+        bool next()
+        {
+            if (memory)
+            {
+                if (pos == memory->size())
+                    return false;
+                head = &(*memory)[pos++];
+                return true;
+            }
+
+            uint32_t length;
+            if (!in.read((char*)&length, sizeof(length)))
+                return false;
+            entry.id.resize(length);
+            int64_t offset;
+            in.read(&entry.id[0], length);
+            in.read((char*)&offset, sizeof(offset));
+            entry.offset = (long)offset;
+            head = &entry;
+            return (bool)in;
+        }
+    };
+
+    string runPrefix;
+    size_t budget;
+    size_t used = 0;
+    vector<IndexEntry> buffer;
+    bool sorted = false;
+    vector<string> runs;
+    bool failed = false;
+
+    void spill()
+    {
+        sort(buffer.begin(), buffer.end(), less);
+
+        string file = runPrefix + ".run" + to_string(runs.size());
+        ofstream out(file, ios::binary | ios::trunc);
+        for (const auto& e : buffer)
+        {
+            uint32_t length = e.id.size();
+            int64_t offset = e.offset;
+            out.write((const char*)&length, sizeof(length));
+            out.write(e.id.data(), length);
+            out.write((const char*)&offset, sizeof(offset));
+        }
+        if (!out)
+        {
+            cout << "Error writing sort run " << file << "!\n";
+            failed = true;
+        }
+        runs.push_back(file);
+
+        buffer.clear();
+        buffer.shrink_to_fit();
+        used = 0;
+    }
+
+public:
+    static const size_t DefaultBudget = 64 << 20;
+
+    explicit ExternalSorter(const string& prefix, size_t memoryBudget = DefaultBudget)
+            : runPrefix(prefix), budget(memoryBudget) {
+    }
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    ~ExternalSorter()
+    {
+        for (const string& file : runs)
+            remove(file.c_str());
+    }
+
+    void add(const string& key, long offset)
+    {
+        sorted = false;
+        buffer.push_back({ key, offset });
+        used += sizeof(IndexEntry) + key.capacity();
+        if (used >= budget)
+            spill();
+    }
+
+    // Sort what is still in memory. Done by merge() otherwise; sorters
+    // filled on worker threads call it there, so the sorts run in parallel.
+    void finish()
+    {
+        if (!sorted)
+            sort(buffer.begin(), buffer.end(), less);
+        sorted = true;
+    }
+
+    // Calls f(key, offset) for every entry in order. Returns false if a run
+    // could not be written or read back.
+    template <class F>
+    bool merge(F f)
+    {
+        return mergeAll({ this }, f);
+    }
+
+    // Calls f(key, offset) for every entry of all the sorters, in order: a
+    // k-way merge of their runs and sorted buffers
+    template <class F>
+    static bool mergeAll(const vector<ExternalSorter*>& sorters, F f)
+    {
+        vector<unique_ptr<Run>> open;
+        for (ExternalSorter* sorter : sorters)
+        {
+            if (sorter->failed)
+                return false;
+            sorter->finish();
+            for (const string& file : sorter->runs)
+            {
+                unique_ptr<Run> run(new Run());
+                run->in.open(file, ios::binary);
+                if (!run->in)
+                    return false;
+                if (run->next())
+                    open.push_back(move(run));
+            }
+            unique_ptr<Run> memory(new Run());
+            memory->memory = &sorter->buffer;
+            if (memory->next())
+                open.push_back(move(memory));
+        }
+
+        // Everything in one place (the common case: it all fit in memory)
+        if (open.size() == 1)
+        {
+            do
+                f(open[0]->head->id, open[0]->head->offset);
+            while (open[0]->next());
+            return !open[0]->in.bad();
+        }
+
+        auto later = [&](size_t a, size_t b) { return less(*open[b]->head, *open[a]->head); };
+        priority_queue<size_t, vector<size_t>, decltype(later)> heads(later);
+        for (size_t i = 0; i < open.size(); i++)
+            heads.push(i);
+
+        while (!heads.empty())
+        {
+            size_t i = heads.top();
+            heads.pop();
+            f(open[i]->head->id, open[i]->head->offset);
+            if (open[i]->next())
+                heads.push(i);
+        }
+        return true;
+    }
+};
+
+// An ExternalSorter per worker thread, each with its share of the budget,
+// for index builds that parse the data file in parallel. Workers add to
+// their own part only; merge() sorts the parts in parallel and merges them,
+// giving the same order as one ExternalSorter fed everything.
+class PartitionedSorter
+{
+private:
+    vector<unique_ptr<ExternalSorter>> parts;
+
+public:
+    PartitionedSorter(const string& prefix, size_t memoryBudget, unsigned workers)
+    {
+        workers = workerCount(workers);
+        for (unsigned w = 0; w < workers; ++w)
+            parts.emplace_back(new ExternalSorter(prefix + "." + to_string(w), max<size_t>(memoryBudget / workers, 1)));
+    }
+
+    unsigned workers() const { return (unsigned)parts.size(); }
+
+    void add(unsigned worker, const string& key, long offset)
+    {
+        parts[worker]->add(key, offset);
+    }
+
+    template <class F>
+    bool merge(F f)
+    {
+        parallelFor(parts.size(), workers(), [&](size_t i, unsigned) { parts[i]->finish(); });
+        vector<ExternalSorter*> all;
+        for (auto& part : parts)
+            all.push_back(part.get());
+        return ExternalSorter::mergeAll(all, f);
+    }
+};
+
+// Calls emit(worker, line, offset) for every line of a data file, from
+// `workers` threads. The file is mapped once and cut into chunks at line
+// boundaries: a chunk owns the lines that start inside it, so each line is
+// seen exactly once, though not in file order. Lines come without their
+// '\n' (a '\r' before it stays, as with getline). False if the file can't
+// be opened.
+template <class F>
+bool scanLines(const string& path, unsigned workers, F emit)
+{
+    static const size_t MinChunk = 1 << 20;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+    void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    ::madvise(p, size, MADV_SEQUENTIAL);
+    const char* data = (const char*)p;
+
+    // A few chunks per worker, so one slow chunk doesn't leave the rest idle
+    workers = workerCount(workers);
+    size_t chunks = min<size_t>(max<size_t>(size / MinChunk, 1), (size_t)workers * 4);
+
+    parallelFor(chunks, workers, [&](size_t c, unsigned worker) {
+        size_t begin = size * c / chunks;
+        size_t end = size * (c + 1) / chunks;
+        // The line running into the chunk belongs to the one before
+        if (begin > 0 && data[begin - 1] != '\n')
+        {
+            const char* nl = (const char*)memchr(data + begin, '\n', size - begin);
+            begin = nl ? nl - data + 1 : size;
+        }
+
+        string line;
+        while (begin < end)
+        {
+            const char* nl = (const char*)memchr(data + begin, '\n', size - begin);
+            size_t stop = nl ? nl - data : size;
+            line.assign(data + begin, stop - begin);
+            emit(worker, line, (long)begin);
+            begin = stop + 1;
+        }
+    });
+
+    ::munmap(p, size);
+    return true;
+}
+
+class SecondaryIndexDoctorID
+{
+private:
+    string indexfile;
+    string sourcefile;
+
+    struct DoctorEntry
+    {
+        string doctorID;
+        vector<string> appIDs;
+        vector<long> offsets;
+    };
+
+    // Kept sorted by doctorID at all times (a flat sorted map), so every
+    // lookup is a binary search instead of a scan.
+    vector<DoctorEntry> indexList;
+    // Set by lookups that found the index out of step with the data file;
+    // atomic because concurrent readers may set it
+    mutable atomic<bool> inconsistent{ false };
+    // Changed since the last saved snapshot; the changes are in `delta`
+    bool dirty = false;
+    DeltaLog delta;
+
+    static bool lessByDoctor(const DoctorEntry& a, const DoctorEntry& b)
+    {
+        return a.doctorID < b.doctorID;
+    }
+
+    vector<DoctorEntry>::const_iterator lowerBound(const string& key) const
+    {
+        return lower_bound(indexList.begin(), indexList.end(), key,
+                           [](const DoctorEntry& e, const string& k) { return e.doctorID < k; });
+    }
+
+    int findDoctor(const string& key) const
+    {
+        auto it = lowerBound(key);
+        if (it == indexList.end() || it->doctorID != key)
+            return -1;
+        return (int)(it - indexList.begin());
+    }
+
+    // The in-memory side of addEntry/removeEntry, also used by delta replay.
+    // Adding a posting that is already there does nothing.
+    void insertPosting(const string& doctorID, const string& appID, long offset)
+    {
+        int pos = findDoctor(doctorID);
+        if (pos == -1)
+        {
+            indexList.insert(indexList.begin() + (lowerBound(doctorID) - indexList.begin()),
+                             DoctorEntry{ doctorID, {appID}, {offset} });
+            return;
+        }
+        DoctorEntry& entry = indexList[pos];
+        if (find(entry.offsets.begin(), entry.offsets.end(), offset) != entry.offsets.end())
+            return;
+        entry.appIDs.push_back(appID);
+        entry.offsets.push_back(offset);
+    }
+
+    void erasePosting(const string& doctorID, long offset)
+    {
+        int pos = findDoctor(doctorID);
+        if (pos == -1) return;
+
+        DoctorEntry& entry = indexList[pos];
+        for (size_t i = 0; i < entry.offsets.size(); ++i)
+        {
+            if (entry.offsets[i] != offset) continue;
+            entry.offsets.erase(entry.offsets.begin() + i);
+            if (i < entry.appIDs.size())
+                entry.appIDs.erase(entry.appIDs.begin() + i);
+            break;
+        }
+        if (entry.offsets.empty())
+            indexList.erase(indexList.begin() + pos);
+    }
+
+    // Re-point a posting in place; the doctor's entry keeps its slot
+    void movePosting(const string& doctorID, const string& appID, long from, long to)
+    {
+        int pos = findDoctor(doctorID);
+        if (pos == -1)
+        {
+            insertPosting(doctorID, appID, to);
+            return;
+        }
+        DoctorEntry& entry = indexList[pos];
+        if (find(entry.offsets.begin(), entry.offsets.end(), to) != entry.offsets.end())
+        {
+            erasePosting(doctorID, from);
+            return;
+        }
+        auto it = find(entry.offsets.begin(), entry.offsets.end(), from);
+        if (it != entry.offsets.end())
+            *it = to;
+        else
+            insertPosting(doctorID, appID, to);
+    }
+
+    // Write the snapshot to a temp file and put it in place of the old one.
+    // The delta log is left to the caller: a checkpoint clears it only
+    // after cutting the write-ahead log.
+    bool writeSnapshot()
+    {
+        string tmp = indexfile + ".tmp";
+        {
+            ofstream idx(tmp, ios::trunc);
+            for (const auto& entry : indexList)
+            {
+                idx << entry.doctorID << "|";
+                for (size_t i = 0; i < entry.offsets.size(); ++i)
+                {
+                    idx << entry.offsets[i];
+                    if (i < entry.offsets.size() - 1) idx << ",";
+                }
+                idx << "\n";
+            }
+            if (!idx.flush())
+                return false;
+        }
+        if (!replaceFile(tmp, indexfile))
+            return false;
+        dirty = false;
+        return true;
+    }
+
+public:
+    SecondaryIndexDoctorID(const string& idxFile, const string& srcFile)
+            : indexfile(idxFile), sourcefile(srcFile), delta(idxFile + ".delta") {
+    }
+
+    void attachLog(WriteAheadLog& log) { delta.attach(log); }
+
+    bool isDirty() const { return dirty; }
+
+    // Extract the appointment and doctor IDs from one appointments.txt line.
+    // Returns false for blank, malformed or deleted ('*') records.
+    static bool parseRecord(const string& line, string& appID, string& doctorID)
+    {
+        if (line.size() < 5 || line[3] == '*') return false;
+
+        // length header|appID|date|doctorID, whitespace after each '|'
+        // ignored. Plain scanning: index rebuilds call this from many threads
+        // at once, and a stringstream per line would serialize them on the
+        // shared locale.
+        auto skipSpace = [&](size_t p) {
+            while (p < line.size() && isspace((unsigned char)line[p])) p++;
+            return p;
+        };
+        size_t p1 = line.find('|');
+        if (p1 == string::npos) return false;
+        size_t idStart = skipSpace(p1 + 1);
+        size_t p2 = line.find('|', idStart);
+        if (p2 == string::npos) return false;
+        size_t p3 = line.find('|', skipSpace(p2 + 1));
+        if (p3 == string::npos) return false;
+
+        appID = line.substr(idStart, p2 - idStart);
+        doctorID = line.substr(skipSpace(p3 + 1));
+
+        // Reused slots are space padded and old files carry '\r'
+        appID = appID.substr(0, appID.find_last_not_of(" \r") + 1);
+        doctorID = doctorID.substr(0, doctorID.find_last_not_of(" \r") + 1);
+        if (appID.empty() || doctorID.empty()) return false;
+
+        if (appID.length() == 1) appID = "0" + appID;
+        if (doctorID.length() == 1) doctorID = "0" + doctorID;
+        return true;
+    }
+
+    // Full rebuild from appointments.txt. Only needed at startup when the
+    // index file is missing/stale or after an inconsistency was detected;
+    // normal mutations go through addEntry/removeEntry/updateEntry.
+    void createIndex(size_t memoryBudget = ExternalSorter::DefaultBudget, unsigned workers = 0,
+                     ostream& out = cout)
+    {
+        Stats::Timer timer(Stats::IndexRebuild);
+
+        // Postings go through an external sort, so the scan never holds more
+        // than the sorter's budget on top of the finished index. Chunks of
+        // the file are parsed on `workers` threads (0 = one per core).
+        PartitionedSorter sorter(indexfile, memoryBudget, workers);
+        bool scanned = scanLines(sourcefile, sorter.workers(), [&](unsigned worker, const string& line, long offset) {
+            string appID, doctorID;
+            if (parseRecord(line, appID, doctorID))
+                sorter.add(worker, doctorID, offset);
+        });
+        if (!scanned) {
+            out << "Error opening source file: " << sourcefile << endl;
+            return;
+        }
+        Stats::get().addScan(sourcefile);
+
+        indexList.clear();
+
+        // Sorted by doctor, then offset: group runs of the same doctor.
+        // Appointment IDs aren't kept, same as after loadIndex.
+        bool merged = sorter.merge([&](const string& doctorID, long off) {
+            if (indexList.empty() || indexList.back().doctorID != doctorID)
+                indexList.push_back({ doctorID });
+            indexList.back().offsets.push_back(off);
+            indexList.back().appIDs.emplace_back();
+        });
+        if (!merged)
+        {
+            out << "Error: Failed to sort the doctor ID index!\n";
+            return;
+        }
+        if (!writeSnapshot())
+        {
+            out << "Error writing to " << indexfile << "!\n";
+            return;
+        }
+        delta.clear();
+        inconsistent = false;
+        out << "SecondaryIndexDoctorID created successfully!\n";
+    }
+
+    // Register a newly written appointment under its doctor. Like the other
+    // mutators this changes memory and records the change in the delta log;
+    // the snapshot is saved by Database::checkpoint.
+    void addEntry(const string& doctorID, const string& appID, long offset)
+    {
+        insertPosting(doctorID, appID, offset);
+        delta.append("+ " + doctorID + " " + to_string(offset));
+        dirty = true;
+    }
+
+    // Drop the posting at offset from the doctor's list
+    void removeEntry(const string& doctorID, long offset)
+    {
+        erasePosting(doctorID, offset);
+        delta.append("- " + doctorID + " " + to_string(offset));
+        dirty = true;
+    }
+
+    // Move the posting at offset from one doctor to another
+    void updateEntry(const string& oldDoctorID, const string& newDoctorID,
+                     const string& appID, long offset)
+    {
+        if (oldDoctorID == newDoctorID) return;
+        removeEntry(oldDoctorID, offset);
+        addEntry(newDoctorID, appID, offset);
+    }
+
+    // The record moved within appointments.txt (compaction)
+    void moveEntry(const string& doctorID, const string& appID, long from, long to)
+    {
+        movePosting(doctorID, appID, from, to);
+        delta.append("> " + doctorID + " " + to_string(from) + " " + to_string(to));
+        dirty = true;
+    }
+
+    // True when the index file is older than appointments.txt, i.e. the data
+    // was changed behind our back since the last save.
+    bool isStale() const
+    {
+        error_code ec1, ec2;
+        auto idxTime = filesystem::last_write_time(indexfile, ec1);
+        auto srcTime = filesystem::last_write_time(sourcefile, ec2);
+        if (ec1 || ec2) return true;
+        return idxTime < srcTime;
+    }
+
+    // Set when a lookup hit a posting that no longer matches the data file
+    bool needsRebuild() const { return inconsistent; }
+
+    // Only writes when something changed. A clean index just has its
+    // timestamp bumped, so isStale() keeps seeing it as current after
+    // appointments.txt changed in ways that don't affect it. Returns false
+    // if the snapshot could not be written and synced.
+    bool saveIndex()
+    {
+        if (dirty)
+        {
+            if (writeSnapshot()) return true;
+            cout << "Error writing to " << indexfile << "!\n";
+            return false;
+        }
+        error_code ec;
+        filesystem::last_write_time(indexfile, filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    // Forget the changes since the last snapshot, once nothing can replay them
+    void clearDelta() { delta.clear(); }
+
+    bool loadIndex()
+    {
+        ifstream idx(indexfile);
+        if (!idx)
+        {
+            cout << "Index file missing! Run createIndex() first.\n";
+            return false;
+        }
+        indexList.clear();
+        string line;
+        while (getline(idx, line))
+        {
+            if (line.empty()) continue;
+            stringstream ss(line);
+            string docID, offsetStr;
+            getline(ss, docID, '|');
+            getline(ss, offsetStr);
+
+            DoctorEntry entry{ docID };
+            stringstream offSS(offsetStr);
+            string token;
+            while (getline(offSS, token, ','))
+                if (!token.empty())
+                    entry.offsets.push_back(stol(token));
+            entry.appIDs.resize(entry.offsets.size());
+            indexList.push_back(entry);
+        }
+        idx.close();
+        // Files written by older builds may not be ordered
+        if (!is_sorted(indexList.begin(), indexList.end(), lessByDoctor))
+            sort(indexList.begin(), indexList.end(), lessByDoctor);
+
+        // Changes committed after the snapshot was saved
+        dirty = delta.replay([&](const string& change) {
+            stringstream ss(change);
+            string op, doctorID;
+            long offset, to;
+            if (!(ss >> op >> doctorID >> offset)) return;
+            if (op == "+")
+                insertPosting(doctorID, "", offset);
+            else if (op == ">")
+            {
+                if (ss >> to) movePosting(doctorID, "", offset, to);
+            }
+            else
+                erasePosting(doctorID, offset);
+        }) > 0;
+        inconsistent = false;
+        cout << "Index loaded successfully!\n";
+        return true;
+    }
+
+    vector<pair<string, long>> searchByID(const string& keyID) const
+    {
+        vector<pair<string, long>> results;
+        string searchKey = keyID;
+        if (searchKey.length() == 1) searchKey = "0" + searchKey;
+
+        int pos = findDoctor(searchKey);
+        if (pos == -1) return results;
+
+        RecordFile& data = RecordFile::get(sourcefile);
+        if (!data.isOpen()) {
+            cout << "Error: Cannot open appointments.txt!\n";
+            return results;
+        }
+
+        for (long offset : indexList[pos].offsets)
+        {
+            if (auto record = RecordCache::get().read(sourcefile, offset))
+            {
+                string appID, doctorID;
+                if (!parseRecord(record->line, appID, doctorID) || doctorID != searchKey)
+                {
+                    inconsistent = true;
+                    continue;
+                }
+                results.push_back({ appID, offset });
+            }
+            else
+                inconsistent = true;
+        }
+        return results;
+    }
+
+    string getRecordAtOffset(long offset) const
+    {
+        RecordFile& data = RecordFile::get(sourcefile);
+        if (!data.isOpen()) return "ERROR: Cannot open appointments.txt";
+
+        if (auto record = RecordCache::get().read(sourcefile, offset))
+            return record->line;
+        return "ERROR: Invalid offset";
+    }
+};
+
+// ====================== Secondary Index on Doctor Name (doctors.txt) ======================
+class SecondaryIndexDoctorName
+{
+private:
+    // First line of every snapshot written since the index is maintained
+    // incrementally. Older files were only rebuilt per command and can hold
+    // entries for deleted doctors (whose slots may since have been reused),
+    // so they are rebuilt from the data file once instead of trusted.
+    static constexpr const char* SnapshotHeader = "#HMS doctor name index 2";
+
+    string indexfile;
+    string sourcefile;
+    vector<IndexEntry> indexList;
+    // normalized name -> offset, for case/space-insensitive uniqueness checks
+    unordered_multimap<string, long> normalizedNames;
+    // Set by searchByName when the record it points at disagrees
+    mutable atomic<bool> inconsistent{ false };
+    // Changed since the last saved snapshot; the changes are in `delta`
+    bool dirty = false;
+    DeltaLog delta;
+
+    int binarySearch(const string& key) const
+    {
+        int low = 0, high = (int)indexList.size() - 1;
+        while (low <= high)
+        {
+            int mid = (low + high) / 2;
+            if (indexList[mid].id == key) return mid;
+            if (indexList[mid].id < key) low = mid + 1;
+            else high = mid - 1;
+        }
+        return -1;
+    }
+
+    void rebuildNormalized()
+    {
+        normalizedNames.clear();
+        normalizedNames.reserve(indexList.size());
+        for (const auto& e : indexList)
+            normalizedNames.emplace(normalizeName(e.id), e.offset);
+    }
+
+    void eraseNormalized(const string& name, long offset)
+    {
+        auto range = normalizedNames.equal_range(normalizeName(name));
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == offset)
+            {
+                normalizedNames.erase(it);
+                return;
+            }
+        }
+    }
+
+    // The in-memory side of addEntry/removeEntry, also used by delta replay.
+    // Adding an entry that is already there does nothing.
+    void insertName(const string& name, long offset)
+    {
+        IndexEntry entry{ name, offset };
+        auto less = [](const IndexEntry& a, const IndexEntry& b) { return a.id < b.id; };
+        auto range = equal_range(indexList.begin(), indexList.end(), entry, less);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->offset == offset) return;
+        indexList.insert(range.second, entry);
+        normalizedNames.emplace(normalizeName(name), offset);
+    }
+
+    void eraseName(const string& name, long offset)
+    {
+        auto range = equal_range(indexList.begin(), indexList.end(), IndexEntry{ name, offset },
+                                 [](const IndexEntry& a, const IndexEntry& b) { return a.id < b.id; });
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->offset == offset)
+            {
+                indexList.erase(it);
+                eraseNormalized(name, offset);
+                break;
+            }
+        }
+    }
+
+    // Re-point an entry in place; the name keeps its position in the list
+    void moveName(const string& name, long from, long to)
+    {
+        auto range = equal_range(indexList.begin(), indexList.end(), IndexEntry{ name, from },
+                                 [](const IndexEntry& a, const IndexEntry& b) { return a.id < b.id; });
+        auto moved = range.second;
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->offset == to)
+            {
+                eraseName(name, from);
+                return;
+            }
+            if (it->offset == from) moved = it;
+        }
+        if (moved == range.second)
+        {
+            insertName(name, to);
+            return;
+        }
+        moved->offset = to;
+        auto same = normalizedNames.equal_range(normalizeName(name));
+        for (auto it = same.first; it != same.second; ++it)
+        {
+            if (it->second == from)
+            {
+                it->second = to;
+                break;
+            }
+        }
+    }
+
+    // See SecondaryIndexDoctorID::writeSnapshot
+    bool writeSnapshot()
+    {
+        string tmp = indexfile + ".tmp";
+        {
+            ofstream idx(tmp, ios::trunc);
+            sort(indexList.begin(), indexList.end(),
+                 [](const IndexEntry& a, const IndexEntry& b) { return a.id < b.id; });
+            idx << SnapshotHeader << "\n";
+            for (const auto& e : indexList)
+                idx << e.id << "|" << e.offset << "\n";
+            if (!idx.flush())
+                return false;
+        }
+        if (!replaceFile(tmp, indexfile))
+            return false;
+        dirty = false;
+        return true;
+    }
+
+public:
+    SecondaryIndexDoctorName(const string& idxFile, const string& srcFile)
+            : indexfile(idxFile), sourcefile(srcFile), delta(idxFile + ".delta") {
+    }
+
+    void attachLog(WriteAheadLog& log) { delta.attach(log); }
+
+    bool isDirty() const { return dirty; }
+
+
+    // Extract the name field from one doctors.txt line.
+    // Returns false for blank, malformed or deleted ('*') records.
+    static bool parseRecord(const string& line, string& name)
+    {
+        if (line.size() < 5 || line[3] == '*') return false;
+
+        size_t p1 = line.find('|');
+        size_t p2 = line.find('|', p1 + 1);
+        size_t p3 = line.find('|', p2 + 1);
+        if (p1 == string::npos || p2 == string::npos || p3 == string::npos)
+            return false;
+
+        name = line.substr(p2 + 1, p3 - p2 - 1);
+        return true;
+    }
+
+    // Lowercase, trim and collapse inner runs of spaces, so "Dr  Ali " and
+    // "dr ali" count as the same doctor name.
+    static string normalizeName(const string& s)
+    {
+        string out;
+        out.reserve(s.size());
+        bool pendingSpace = false;
+        for (char c : s)
+        {
+            if (c == ' ')
+            {
+                pendingSpace = !out.empty();
+                continue;
+            }
+            if (pendingSpace) out += ' ';
+            pendingSpace = false;
+            out += (char)tolower((unsigned char)c);
+        }
+        return out;
+    }
+
+    // True if a live doctor other than the one at excludeOffset already
+    // uses this name after normalization. No disk I/O.
+    bool nameExists(const string& name, long excludeOffset = -1) const
+    {
+        string key = normalizeName(name);
+        if (key.empty()) return false;
+        auto range = normalizedNames.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second != excludeOffset) return true;
+        return false;
+    }
+
+    // Full rebuild from doctors.txt, see SecondaryIndexDoctorID::createIndex
+    void createIndex(size_t memoryBudget = ExternalSorter::DefaultBudget, unsigned workers = 0,
+                     ostream& out = cout)
+    {
+        Stats::Timer timer(Stats::IndexRebuild);
+        PartitionedSorter sorter(indexfile, memoryBudget, workers);
+        bool scanned = scanLines(sourcefile, sorter.workers(), [&](unsigned worker, const string& line, long offset) {
+            string name;
+            if (parseRecord(line, name))
+                sorter.add(worker, name, offset);
+        });
+        if (!scanned) {
+            out << "Error opening doctors.txt!\n";
+            return;
+        }
+        Stats::get().addScan(sourcefile);
+
+        indexList.clear();
+
+        if (!sorter.merge([&](const string& name, long offset) {
+                indexList.push_back({ name, offset });
+            }))
+        {
+            out << "Error: Failed to sort the doctor name index!\n";
+            return;
+        }
+        rebuildNormalized();
+        if (!writeSnapshot())
+        {
+            out << "Error writing to " << indexfile << "!\n";
+            return;
+        }
+        delta.clear();
+        inconsistent = false;
+    }
+
+    // Memory plus the delta log; the snapshot is saved by Database::checkpoint
+    void addEntry(const string& name, long offset)
+    {
+        insertName(name, offset);
+        delta.append("+ " + to_string(offset) + " " + name);
+        dirty = true;
+    }
+
+    void removeEntry(const string& name, long offset)
+    {
+        eraseName(name, offset);
+        delta.append("- " + to_string(offset) + " " + name);
+        dirty = true;
+    }
+
+    void updateEntry(const string& oldName, const string& newName, long offset)
+    {
+        if (oldName == newName) return;
+        removeEntry(oldName, offset);
+        addEntry(newName, offset);
+    }
+
+    // The record moved within doctors.txt (compaction)
+    void moveEntry(const string& name, long from, long to)
+    {
+        moveName(name, from, to);
+        delta.append("> " + to_string(from) + " " + to_string(to) + " " + name);
+        dirty = true;
+    }
+
+    // See SecondaryIndexDoctorID::isStale
+    bool isStale() const
+    {
+        error_code ec1, ec2;
+        auto idxTime = filesystem::last_write_time(indexfile, ec1);
+        auto srcTime = filesystem::last_write_time(sourcefile, ec2);
+        if (ec1 || ec2) return true;
+        return idxTime < srcTime;
+    }
+
+    bool needsRebuild() const { return inconsistent; }
+
+    // See SecondaryIndexDoctorID::saveIndex
+    bool saveIndex()
+    {
+        if (dirty)
+        {
+            if (writeSnapshot()) return true;
+            cout << "Error writing to " << indexfile << "!\n";
+            return false;
+        }
+        error_code ec;
+        filesystem::last_write_time(indexfile, filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    void clearDelta() { delta.clear(); }
+
+    bool loadIndex()
+    {
+        ifstream idx(indexfile);
+        if (!idx)
+        {
+            cout << "Doctor name index missing! Run createIndex first.\n";
+            return false;
+        }
+        string line;
+        if (!getline(idx, line) || line != SnapshotHeader)
+        {
+            cout << "Doctor name index is in the old format, rebuilding it.\n";
+            return false;
+        }
+        indexList.clear();
+        while (getline(idx, line))
+        {
+            stringstream ss(line);
+            string name, off;
+            getline(ss, name, '|');
+            getline(ss, off);
+            if (!off.empty())
+                indexList.push_back({ name, stol(off) });
+        }
+        idx.close();
+
+        // Changes committed after the snapshot was saved
+        dirty = delta.replay([&](const string& change) {
+            size_t p1 = change.find(' ');
+            size_t p2 = change.find(' ', p1 + 1);
+            if (p1 == string::npos || p2 == string::npos) return;
+            long offset = atol(change.c_str() + p1 + 1);
+            if (change[0] == '>')
+            {
+                size_t p3 = change.find(' ', p2 + 1);
+                if (p3 == string::npos) return;
+                moveName(change.substr(p3 + 1), offset, atol(change.c_str() + p2 + 1));
+                return;
+            }
+            string name = change.substr(p2 + 1);
+            if (change[0] == '+')
+                insertName(name, offset);
+            else
+                eraseName(name, offset);
+        }) > 0;
+
+        rebuildNormalized();
+        inconsistent = false;
+        cout << "Doctor name index loaded.\n";
+        return true;
+    }
+
+    // Updated function: returns both offset and full record
+    pair<long, string> searchByName(const string& name) const
+    {
+        int pos = binarySearch(name);
+        if (pos == -1)
+            return { -1, "Doctor not found" };
+
+        long offset = indexList[pos].offset;
+
+        RecordFile& data = RecordFile::get(sourcefile);
+        if (!data.isOpen())
+            return { -1, "ERROR: Cannot open doctors.txt" };
+
+        if (auto record = RecordCache::get().read(sourcefile, offset))
+        {
+            string recordName;
+            if (!parseRecord(record->line, recordName) || recordName != name)
+                inconsistent = true;
+            return { offset, record->line };
+        }
+
+        inconsistent = true;
+
+        return { offset, "ERROR: Failed to read record" };
+    }
+
+    long getOffsetByName(const string& name) const
+    {
+        int pos = binarySearch(name);
+        return (pos == -1) ? -1 : indexList[pos].offset;
+    }
+
+    string getDoctorRecord(long offset) const
+    {
+        RecordFile& data = RecordFile::get(sourcefile);
+        if (!data.isOpen()) return "ERROR: Cannot open doctors.txt";
+        auto record = RecordCache::get().read(sourcefile, offset);
+        return record ? record->line : "ERROR: Empty record";
+    }
+};
+
+
+// ====================== Binary Primary Index Format ======================
+// DocIndexFile.idx / AppointmentsIndexfile.idx: a PrimaryIndexHeader followed
+// by `count` fixed-width BinaryIndexEntry records sorted by key. The file is
+// mapped and binary-searched in place, so loading does no parsing at all.
+struct PrimaryIndexHeader
+{
+    char magic[8];          // "HMSPIDX"
+    uint32_t version;
+    uint32_t keyWidth;      // sizeof(BinaryIndexEntry::key)
+    uint64_t count;
+};
+
+struct BinaryIndexEntry
+{
+    char key[16];           // ID, NUL padded
+    int64_t offset;
+};
+
+static_assert(sizeof(PrimaryIndexHeader) == 24, "index header must stay 24 bytes");
+static_assert(sizeof(BinaryIndexEntry) == 24, "index entry must stay 24 bytes");
+
+static const char PrimaryIndexMagic[8] = "HMSPIDX";
+static const uint32_t PrimaryIndexVersion = 1;
+
+
+// ====================== Page Cache (Buffer Pool) ======================
+// Fixed-size pages of a file cached in a bounded set of frames. Eviction is
+// CLOCK (second chance): each access sets a frame's reference bit and the
+// hand clears bits until it finds an unpinned frame without one. Dirty
+// frames are written back on eviction or flush(), so a mutation only costs
+// writes for the pages it actually touched.
+//
+// Written-back pages never go straight into the file: a split touches
+// several pages, and a crash between their writes would leave a torn tree.
+// They are appended to a journal next to it (<file>.journal), from which
+// evicted pages are also read back. flush() journals the remaining dirty
+// pages, adds a commit record and syncs the journal; only then are the
+// pages copied into place and the file synced, after which the journal is
+// emptied. A crash before the commit record is durable leaves the file as
+// of the last flush; one after it leaves a committed journal that open()
+// finishes applying.
+//
+// Journal: per page  uint32 JournalPage, uint32 page ID,
+//                    uint64 FNV-1a of the page, the page
+//          commit    uint32 JournalCommit, uint32 page count, uint64 0
+class PageCache
+{
+public:
+    static const size_t PageSize = 4096;
+
+private:
+    static const uint32_t JournalPage = 0x4750424a;     // "JBPG"
+    static const uint32_t JournalCommit = 0x4d43424a;   // "JBCM"
+
+    struct Frame
+    {
+        uint32_t pageId = 0;
+        bool used = false;
+        bool referenced = false;
+        bool dirty = false;
+        int pins = 0;
+    };
+
+    struct JournalRecord
+    {
+        uint32_t kind;
+        uint32_t pageId;        // page count for a commit record
+        uint64_t sum;
+    };
+
+    int fd = -1;
+    int journalFd = -1;
+    string journalPath;
+    off_t journalEnd = 0;
+    uint32_t journalCount = 0;
+    // Newest journaled copy of each page written back since the last flush
+    unordered_map<uint32_t, off_t> journaled;
+
+    // Readers of the tree share the cache, so frame bookkeeping is locked
+    mutex lock;
+    vector<char> memory;                // frames.size() * PageSize bytes
+    vector<Frame> frames;
+    unordered_map<uint32_t, size_t> frameOf;
+    size_t hand = 0;
+
+    char* frameData(size_t f) { return memory.data() + f * PageSize; }
+
+    static bool writeAll(int to, const char* p, size_t n, off_t offset)
+    {
+        Stats::get().add(Stats::Seeks);
+        Stats::get().add(Stats::BytesWritten, n);
+        while (n > 0)
+        {
+            ssize_t done = ::pwrite(to, p, n, offset);
+            if (done <= 0) return false;
+            p += done;
+            n -= done;
+            offset += done;
+        }
+        return true;
+    }
+
+    bool appendJournal(uint32_t kind, uint32_t pageId, const char* page)
+    {
+        JournalRecord r{ kind, pageId, page ? checksum(page, PageSize) : 0 };
+        if (!writeAll(journalFd, (const char*)&r, sizeof(r), journalEnd) ||
+            (page && !writeAll(journalFd, page, PageSize, journalEnd + sizeof(r))))
+            return false;
+        if (page)
+        {
+            journaled[pageId] = journalEnd + sizeof(r);
+            journalCount++;
+        }
+        journalEnd += sizeof(r) + (page ? PageSize : 0);
+        return true;
+    }
+
+    bool writeFrame(size_t f)
+    {
+        if (!appendJournal(JournalPage, frames[f].pageId, frameData(f))) return false;
+        frames[f].dirty = false;
+        return true;
+    }
+
+    // Copy the newest journaled copy of each page into the file
+    bool applyJournal()
+    {
+        vector<char> page(PageSize);
+        for (const auto& j : journaled)
+        {
+            if (::pread(journalFd, page.data(), PageSize, j.second) != (ssize_t)PageSize ||
+                !writeAll(fd, page.data(), PageSize, (off_t)j.first * PageSize))
+                return false;
+        }
+        return true;
+    }
+
+    bool resetJournal()
+    {
+        if (::ftruncate(journalFd, 0) != 0 || !syncFile(journalFd)) return false;
+        journalEnd = 0;
+        journalCount = 0;
+        journaled.clear();
+        return true;
+    }
+
+    // Finish a committed journal left by a crash, or drop an unfinished one
+    bool recoverJournal()
+    {
+        struct stat st;
+        if (::fstat(journalFd, &st) != 0) return false;
+        if (st.st_size == 0) return true;
+
+        vector<char> page(PageSize);
+        off_t at = 0;
+        uint32_t count = 0;
+        bool committed = false;
+        while (true)
+        {
+            JournalRecord r;
+            if (::pread(journalFd, &r, sizeof(r), at) != (ssize_t)sizeof(r)) break;
+            at += sizeof(r);
+            if (r.kind == JournalCommit)
+            {
+                committed = r.pageId == count;
+                break;
+            }
+            if (r.kind != JournalPage ||
+                ::pread(journalFd, page.data(), PageSize, at) != (ssize_t)PageSize ||
+                checksum(page.data(), PageSize) != r.sum)
+                break;
+            journaled[r.pageId] = at;
+            at += PageSize;
+            count++;
+        }
+
+        if (committed && !(applyJournal() && syncFile(fd)))
+            return false;
+        return resetJournal();
+    }
+
+    // Pick a frame to (re)use with the CLOCK policy
+    size_t victim()
+    {
+        for (size_t step = 0; step < 2 * frames.size(); step++)
+        {
+            size_t f = hand;
+            hand = (hand + 1) % frames.size();
+
+            if (!frames[f].used) return f;
+            if (frames[f].pins > 0) continue;
+            if (frames[f].referenced)
+            {
+                frames[f].referenced = false;
+                continue;
+            }
+            if (frames[f].dirty && !writeFrame(f)) continue;
+            frameOf.erase(frames[f].pageId);
+            frames[f].used = false;
+            return f;
+        }
+        return frames.size();
+    }
+
+public:
+    PageCache(size_t budgetBytes)
+    {
+        size_t count = max<size_t>(budgetBytes / PageSize, 16);
+        memory.resize(count * PageSize);
+        frames.resize(count);
+    }
+
+    PageCache(const PageCache&) = delete;
+    PageCache& operator=(const PageCache&) = delete;
+
+    ~PageCache() { close(); }
+
+    bool open(const string& path)
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) return false;
+        Stats::get().add(Stats::FileOpens);
+
+        journalPath = path + ".journal";
+        journalFd = ::open(journalPath.c_str(), O_RDWR | O_CREAT, 0644);
+        if (journalFd != -1)
+            Stats::get().add(Stats::FileOpens);
+        if (journalFd == -1 || !recoverJournal())
+        {
+            cout << "Error: Cannot recover " << journalPath << "!\n";
+            if (journalFd != -1) ::close(journalFd);
+            ::close(fd);
+            journalFd = fd = -1;
+            journaled.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (fd == -1) return;
+        bool flushed = journalFd != -1 && flush();
+        ::close(fd);
+        fd = -1;
+        if (journalFd != -1)
+            ::close(journalFd);
+        journalFd = -1;
+        // An empty journal has nothing to recover
+        if (flushed)
+            ::unlink(journalPath.c_str());
+    }
+
+    uint32_t pageCount()
+    {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) return 0;
+        return (uint32_t)(st.st_size / PageSize);
+    }
+
+    // Pin a page in memory. A page past the end of the file reads as zeros.
+    // Returns nullptr only if every frame is pinned.
+    char* pin(uint32_t pageId)
+    {
+        lock_guard<mutex> hold(lock);
+        auto it = frameOf.find(pageId);
+        if (it != frameOf.end())
+        {
+            Frame& fr = frames[it->second];
+            fr.referenced = true;
+            fr.pins++;
+            return frameData(it->second);
+        }
+
+        size_t f = victim();
+        if (f == frames.size())
+        {
+            cout << "Error: page cache exhausted (all frames pinned)!\n";
+            return nullptr;
+        }
+
+        // A page written back since the last flush is only in the journal
+        char* data = frameData(f);
+        auto j = journaled.find(pageId);
+        ssize_t n = j != journaled.end() ? ::pread(journalFd, data, PageSize, j->second)
+                                          : ::pread(fd, data, PageSize, (off_t)pageId * PageSize);
+        Stats::get().add(Stats::Seeks);
+        Stats::get().add(Stats::BytesRead, max<ssize_t>(n, 0));
+        if (n < (ssize_t)PageSize)
+            memset(data + max<ssize_t>(n, 0), 0, PageSize - max<ssize_t>(n, 0));
+
+        frames[f] = { pageId, true, true, false, 1 };
+        frameOf[pageId] = f;
+        return data;
+    }
+
+    void unpin(uint32_t pageId, bool dirty)
+    {
+        lock_guard<mutex> hold(lock);
+        auto it = frameOf.find(pageId);
+        if (it == frameOf.end()) return;
+        Frame& fr = frames[it->second];
+        if (fr.pins > 0) fr.pins--;
+        if (dirty) fr.dirty = true;
+    }
+
+    // Write back every dirty page, through the journal; once this returns
+    // true the file is durable as of now
+    bool flush()
+    {
+        lock_guard<mutex> hold(lock);
+        bool ok = true;
+        for (size_t f = 0; f < frames.size(); f++)
+            if (frames[f].used && frames[f].dirty)
+                ok = writeFrame(f) && ok;
+        if (!ok) return false;
+        if (journaled.empty()) return true;
+
+        return appendJournal(JournalCommit, journalCount, nullptr) && syncFile(journalFd) &&
+               applyJournal() && syncFile(fd) && resetJournal();
+    }
+};
+
+// Scoped pin on a PageCache page
+class PageRef
+{
+private:
+    PageCache* cache;
+    uint32_t id;
+    char* bytes;
+    bool dirty = false;
+
+public:
+    PageRef(PageCache& c, uint32_t pageId) : cache(&c), id(pageId), bytes(c.pin(pageId)) {}
+    PageRef(const PageRef&) = delete;
+    PageRef& operator=(const PageRef&) = delete;
+    ~PageRef() { if (bytes) cache->unpin(id, dirty); }
+
+    bool valid() const { return bytes != nullptr; }
+    uint32_t pageId() const { return id; }
+    char* data() { return bytes; }
+    void markDirty() { dirty = true; }
+};
+
+
+// ====================== B+ Tree Primary Index Backend ======================
+// Disk-resident alternative to the in-memory PrimaryIndex list, for tables
+// too large to keep every IndexEntry in RAM. Page 0 holds BTreeMeta; every
+// other page is a leaf (sorted BinaryIndexEntry records chained through
+// `next` for range scans) or an internal node (count keys, count+1 child
+// page IDs). Only the PageCache budget stays resident.
+struct BTreeMeta
+{
+    char magic[8];          // "HMSBPT"
+    uint32_t version;
+    uint32_t pageSize;
+    uint32_t root;
+    uint32_t pageCount;
+    uint64_t entryCount;
+};
+
+struct BTreeNodeHeader
+{
+    uint16_t isLeaf;
+    uint16_t count;
+    uint32_t next;          // right sibling leaf, 0 = none
+};
+
+static const char BTreeMagic[8] = "HMSBPT";
+static const uint32_t BTreeVersion = 1;
+
+class BPlusTree
+{
+private:
+    typedef char Key[sizeof(BinaryIndexEntry::key)];
+
+    static const size_t KeyWidth = sizeof(Key);
+    static const size_t LeafCapacity =
+        (PageCache::PageSize - sizeof(BTreeNodeHeader)) / sizeof(BinaryIndexEntry);
+    static const size_t InternalCapacity =
+        (PageCache::PageSize - sizeof(BTreeNodeHeader) - sizeof(uint32_t)) / (KeyWidth + sizeof(uint32_t));
+
+    PageCache cache;
+    BTreeMeta meta{};
+    bool metaDirty = false;
+
+    static BTreeNodeHeader* header(char* page) { return (BTreeNodeHeader*)page; }
+    static BinaryIndexEntry* leafEntries(char* page) {
+        return (BinaryIndexEntry*)(page + sizeof(BTreeNodeHeader));
+    }
+    static uint32_t* children(char* page) {
+        return (uint32_t*)(page + sizeof(BTreeNodeHeader));
+    }
+    static char* internalKey(char* page, size_t i) {
+        return page + sizeof(BTreeNodeHeader) + (InternalCapacity + 1) * sizeof(uint32_t) + i * KeyWidth;
+    }
+    static string_view keyView(const char* k) {
+        return string_view(k, strnlen(k, KeyWidth));
+    }
+
+    // Index of the child subtree that may contain key
+    static size_t childFor(char* page, string_view key)
+    {
+        size_t low = 0, high = header(page)->count;
+        while (low < high)
+        {
+            size_t mid = (low + high) / 2;
+            if (keyView(internalKey(page, mid)) <= key) low = mid + 1;
+            else high = mid;
+        }
+        return low;
+    }
+
+    // First leaf slot whose key is >= key
+    static size_t leafLowerBound(char* page, string_view key)
+    {
+        BinaryIndexEntry* e = leafEntries(page);
+        size_t low = 0, high = header(page)->count;
+        while (low < high)
+        {
+            size_t mid = (low + high) / 2;
+            if (keyView(e[mid].key) < key) low = mid + 1;
+            else high = mid;
+        }
+        return low;
+    }
+
+    uint32_t allocatePage()
+    {
+        uint32_t id = meta.pageCount++;
+        metaDirty = true;
+        return id;
+    }
+
+    // Leaf page that would hold key (pinned only while walking down)
+    uint32_t findLeaf(string_view key)
+    {
+        uint32_t pageId = meta.root;
+        while (true)
+        {
+            PageRef page(cache, pageId);
+            if (!page.valid()) return 0;
+            if (header(page.data())->isLeaf) return pageId;
+            pageId = children(page.data())[childFor(page.data(), key)];
+        }
+    }
+
+    // Insert into the subtree at pageId. On split, returns true with the
+    // separator key and the new right sibling.
+    bool insertInto(uint32_t pageId, string_view key, long offset,
+                    string& splitKey, uint32_t& splitPage, bool& inserted)
+    {
+        PageRef page(cache, pageId);
+        if (!page.valid()) return false;
+        char* p = page.data();
+        BTreeNodeHeader* h = header(p);
+
+        if (h->isLeaf)
+        {
+            BinaryIndexEntry* e = leafEntries(p);
+            size_t pos = leafLowerBound(p, key);
+            if (pos < h->count && keyView(e[pos].key) == key)
+            {
+                e[pos].offset = offset;
+                page.markDirty();
+                inserted = false;
+                return false;
+            }
+
+            inserted = true;
+            BinaryIndexEntry entry{};
+            memcpy(entry.key, key.data(), key.size());
+            entry.offset = offset;
+
+            if (h->count < LeafCapacity)
+            {
+                memmove(e + pos + 1, e + pos, (h->count - pos) * sizeof(BinaryIndexEntry));
+                e[pos] = entry;
+                h->count++;
+                page.markDirty();
+                return false;
+            }
+
+            // Split: lower half stays, upper half moves to a new right leaf
+            vector<BinaryIndexEntry> all(e, e + h->count);
+            all.insert(all.begin() + pos, entry);
+
+            uint32_t rightId = allocatePage();
+            PageRef right(cache, rightId);
+            if (!right.valid()) return false;
+            char* r = right.data();
+            memset(r, 0, PageCache::PageSize);
+
+            size_t leftCount = all.size() / 2;
+            header(r)->isLeaf = 1;
+            header(r)->count = (uint16_t)(all.size() - leftCount);
+            header(r)->next = h->next;
+            memcpy(leafEntries(r), all.data() + leftCount, header(r)->count * sizeof(BinaryIndexEntry));
+
+            h->count = (uint16_t)leftCount;
+            h->next = rightId;
+            memcpy(e, all.data(), leftCount * sizeof(BinaryIndexEntry));
+
+            page.markDirty();
+            right.markDirty();
+            splitKey = string(keyView(leafEntries(r)[0].key));
+            splitPage = rightId;
+            return true;
+        }
+
+        size_t slot = childFor(p, key);
+        string childKey;
+        uint32_t childPage = 0;
+        if (!insertInto(children(p)[slot], key, offset, childKey, childPage, inserted))
+            return false;
+
+        // The child split: add its separator and new sibling here
+        vector<string> keys;
+        vector<uint32_t> kids(children(p), children(p) + h->count + 1);
+        for (size_t i = 0; i < h->count; i++)
+            keys.push_back(string(keyView(internalKey(p, i))));
+        keys.insert(keys.begin() + slot, childKey);
+        kids.insert(kids.begin() + slot + 1, childPage);
+
+        auto writeNode = [](char* node, const vector<string>& k, const vector<uint32_t>& c,
+                            size_t from, size_t to) {
+            header(node)->isLeaf = 0;
+            header(node)->count = (uint16_t)(to - from);
+            for (size_t i = from; i < to; i++)
+            {
+                memset(internalKey(node, i - from), 0, KeyWidth);
+                memcpy(internalKey(node, i - from), k[i].data(), k[i].size());
+            }
+            memcpy(children(node), c.data() + from, (to - from + 1) * sizeof(uint32_t));
+        };
+
+        page.markDirty();
+        if (keys.size() <= InternalCapacity)
+        {
+            writeNode(p, keys, kids, 0, keys.size());
+            return false;
+        }
+
+        // Split: the middle key moves up, the rest is divided
+        size_t mid = keys.size() / 2;
+        uint32_t rightId = allocatePage();
+        PageRef right(cache, rightId);
+        if (!right.valid()) return false;
+        memset(right.data(), 0, PageCache::PageSize);
+
+        writeNode(p, keys, kids, 0, mid);
+        vector<uint32_t> rightKids(kids.begin() + mid + 1, kids.end());
+        vector<string> rightKeys(keys.begin() + mid + 1, keys.end());
+        writeNode(right.data(), rightKeys, rightKids, 0, rightKeys.size());
+        right.markDirty();
+
+        splitKey = keys[mid];
+        splitPage = rightId;
+        return true;
+    }
+
+    void writeMeta()
+    {
+        PageRef page(cache, 0);
+        if (!page.valid()) return;
+        memcpy(page.data(), &meta, sizeof(meta));
+        page.markDirty();
+        metaDirty = false;
+    }
+
+public:
+    static const size_t DefaultCacheBytes = 8 << 20;
+
+    BPlusTree(size_t cacheBytes = DefaultCacheBytes) : cache(cacheBytes) {}
+
+    ~BPlusTree() { close(); }
+
+    // Open (or create) the tree file
+    bool open(const string& path)
+    {
+        if (!cache.open(path)) return false;
+
+        if (cache.pageCount() == 0)
+        {
+            memcpy(meta.magic, BTreeMagic, sizeof(meta.magic));
+            meta.version = BTreeVersion;
+            meta.pageSize = PageCache::PageSize;
+            meta.root = 1;
+            meta.pageCount = 2;
+            meta.entryCount = 0;
+
+            PageRef root(cache, 1);
+            if (!root.valid()) return false;
+            memset(root.data(), 0, PageCache::PageSize);
+            header(root.data())->isLeaf = 1;
+            root.markDirty();
+            writeMeta();
+            return flush();
+        }
+
+        PageRef page(cache, 0);
+        if (!page.valid()) return false;
+        memcpy(&meta, page.data(), sizeof(meta));
+        if (memcmp(meta.magic, BTreeMagic, sizeof(meta.magic)) != 0 ||
+            meta.version != BTreeVersion || meta.pageSize != PageCache::PageSize)
+        {
+            cout << "Error: " << path << " is not a valid B+ tree index!\n";
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        flush();
+        cache.close();
+    }
+
+    bool flush()
+    {
+        if (metaDirty) writeMeta();
+        return cache.flush();
+    }
+
+    size_t size() const { return meta.entryCount; }
+
+    // -1 if absent
+    long find(string_view key)
+    {
+        if (key.size() > KeyWidth) return -1;
+        PageRef leaf(cache, findLeaf(key));
+        if (!leaf.valid()) return -1;
+
+        size_t pos = leafLowerBound(leaf.data(), key);
+        BinaryIndexEntry* e = leafEntries(leaf.data());
+        if (pos < header(leaf.data())->count && keyView(e[pos].key) == key)
+            return (long)e[pos].offset;
+        return -1;
+    }
+
+    // Insert key or re-point it if already present
+    bool upsert(string_view key, long offset)
+    {
+        if (key.size() > KeyWidth)
+        {
+            cout << "Error: ID " << key << " too long for B+ tree index!\n";
+            return false;
+        }
+
+        string splitKey;
+        uint32_t splitPage = 0;
+        bool inserted = false;
+        if (insertInto(meta.root, key, offset, splitKey, splitPage, inserted))
+        {
+            // Root split: grow the tree by one level
+            uint32_t newRoot = allocatePage();
+            PageRef root(cache, newRoot);
+            if (!root.valid()) return false;
+            char* p = root.data();
+            memset(p, 0, PageCache::PageSize);
+            header(p)->isLeaf = 0;
+            header(p)->count = 1;
+            children(p)[0] = meta.root;
+            children(p)[1] = splitPage;
+            memcpy(internalKey(p, 0), splitKey.data(), splitKey.size());
+            root.markDirty();
+            meta.root = newRoot;
+        }
+        if (inserted)
+            meta.entryCount++;
+        metaDirty = true;
+        return true;
+    }
+
+    // Remove key from its leaf. Leaves are allowed to underflow (no
+    // rebalancing); an empty leaf just stays in the chain.
+    bool erase(string_view key)
+    {
+        if (key.size() > KeyWidth) return false;
+        PageRef leaf(cache, findLeaf(key));
+        if (!leaf.valid()) return false;
+
+        char* p = leaf.data();
+        BinaryIndexEntry* e = leafEntries(p);
+        size_t pos = leafLowerBound(p, key);
+        if (pos >= header(p)->count || keyView(e[pos].key) != key)
+            return false;
+
+        memmove(e + pos, e + pos + 1, (header(p)->count - pos - 1) * sizeof(BinaryIndexEntry));
+        header(p)->count--;
+        leaf.markDirty();
+        meta.entryCount--;
+        metaDirty = true;
+        return true;
+    }
+
+    // Ordered scan of keys in [from, to] (to empty = no upper bound).
+    // f(key, offset) returns false to stop early.
+    template <class F>
+    void scan(string_view from, string_view to, F f)
+    {
+        uint32_t pageId = findLeaf(from);
+        bool first = true;
+        while (pageId != 0)
+        {
+            PageRef leaf(cache, pageId);
+            if (!leaf.valid()) return;
+            BinaryIndexEntry* e = leafEntries(leaf.data());
+            size_t count = header(leaf.data())->count;
+
+            for (size_t i = first ? leafLowerBound(leaf.data(), from) : 0; i < count; i++)
+            {
+                string_view key = keyView(e[i].key);
+                if (!to.empty() && key > to) return;
+                if (!f(key, (long)e[i].offset)) return;
+            }
+            first = false;
+            pageId = header(leaf.data())->next;
+        }
+    }
+};
+
+
+class PrimaryIndex {
+private:
+    string indexfile;
+    string sourcefile;
+
+    // Disk-resident backend, used instead of everything below when the
+    // index file name ends in ".bpt"
+    unique_ptr<BPlusTree> tree;
+    bool treeOpen = false;
+
+    // The other backend's file for the same table (".idx" next to a tree,
+    // ".bpt" next to a flat index); see supersedeOther()
+    string otherfile;
+    bool otherDropped = false;
+
+    vector<IndexEntry> indexList;
+    // False only after addToIndex appended out of order (or an unsorted
+    // legacy text index was loaded); see ensureSorted()
+    atomic<bool> sorted{ true };
+    mutex sortLock;
+    // Changed since the last saved snapshot; logged changes are in `delta`
+    bool dirty = false;
+    DeltaLog delta;
+
+    // Set while the index is served straight from a mapped binary file.
+    // The first mutation copies it into indexList (see materialize()).
+    const BinaryIndexEntry* mapped = nullptr;
+    size_t mappedCount = 0;
+    void* mapBase = nullptr;
+    size_t mapLength = 0;
+
+    // One bit per numeric record ID: set while the record it points to is
+    // live, cleared once it is tombstoned. Lets isLive() answer without
+    // touching the index or the data file. Building it reads every record
+    // the index points at, so that waits for the first isLive() instead of
+    // slowing down every load; until then changes leave it alone.
+    vector<bool> live;
+    atomic<bool> liveBuilt{ false };
+    mutex liveLock;
+    static const long MaxLiveSlot = 1L << 24;
+
+    // Bit position for an ID in the canonical form IdSequence hands out
+    // (digits, zero padded to two). Anything else, e.g. "5" or "007", gets
+    // -1 so it never aliases the bit of "05"/"07".
+    static long slotOf(string_view id) {
+        if (id.size() < 2 || id.size() > 8 || (id.size() > 2 && id[0] == '0'))
+            return -1;
+        long n = 0;
+        for (char c : id) {
+            if (c < '0' || c > '9')
+                return -1;
+            n = n * 10 + (c - '0');
+        }
+        return n < MaxLiveSlot ? n : -1;
+    }
+
+    void setLive(string_view id, bool value) {
+        long slot = slotOf(id);
+        if (slot < 0 || !liveBuilt.load(memory_order_relaxed))
+            return;
+        if ((size_t)slot >= live.size()) {
+            if (!value)
+                return;
+            live.resize(max((size_t)slot + 1, live.size() * 2));
+        }
+        live[slot] = value;
+    }
+
+    // After a snapshot is read: apply the changes logged since it was
+    // saved. Liveness is worked out again when next needed.
+    void loaded() {
+        liveBuilt = false;
+        live.clear();
+        dirty = delta.replay([&](const string& change) {
+            stringstream ss(change);
+            string op, id;
+            long offset = -1;
+            if (!(ss >> op >> id))
+                return;
+            if (op == "+" && (ss >> offset))
+                put(id, offset);
+            else if (op == "-")
+                drop(id);
+        }) > 0;
+    }
+
+    // Only one backend's file is kept current. Before this index first
+    // changes, the other backend's file goes (with its delta log and
+    // journal, durably), so a later run with that backend rebuilds it from
+    // the data file instead of serving entries that have moved on.
+    void supersedeOther() {
+        if (otherDropped || otherfile.empty())
+            return;
+        otherDropped = true;
+        bool removed = false;
+        for (const string& f : { otherfile, otherfile + ".delta", otherfile + ".journal" })
+            removed = ::unlink(f.c_str()) == 0 || removed;
+        if (removed) {
+            string dir = filesystem::path(otherfile).parent_path().string();
+            syncPath(dir.empty() ? "." : dir, true);
+        }
+    }
+
+    void put(const string& id, long offset) {
+        supersedeOther();
+        setLive(id, true);
+        dirty = true;
+        if (tree) {
+            tree->upsert(id, offset);
+            return;
+        }
+
+        materialize();
+        ensureSorted();
+
+        auto it = lower_bound(indexList.begin(), indexList.end(), id,
+                              [](const IndexEntry& e, const string& key) {
+                                  return e.id < key;
+                              });
+        if (it != indexList.end() && it->id == id)
+            it->offset = offset;
+        else
+            indexList.insert(it, { id, offset });
+    }
+
+    void drop(const string& id) {
+        supersedeOther();
+        setLive(id, false);
+        dirty = true;
+        if (tree) {
+            tree->erase(id);
+            return;
+        }
+
+        int pos = binarySearch(id);
+        if (pos == -1)
+            return;
+        materialize();
+        indexList.erase(indexList.begin() + pos);
+    }
+
+    // One pass over the records the index points at, on the first isLive().
+    // Reads the mapped file directly: the scan would only flush the cache.
+    // Callers share the table lock, so one builds while the others wait.
+    void ensureLiveness() {
+        if (liveBuilt.load(memory_order_acquire))
+            return;
+        lock_guard<mutex> hold(liveLock);
+        if (liveBuilt.load(memory_order_relaxed))
+            return;
+        live.clear();
+        if (!sourcefile.empty()) {
+            RecordFile& data = RecordFile::get(sourcefile);
+            forEach([&](string_view id, long offset) {
+                long slot = slotOf(id);
+                string_view record = data.view(offset);
+                if (slot >= 0 && record.size() > 3 && record[3] != '*') {
+                    if ((size_t)slot >= live.size())
+                        live.resize(max((size_t)slot + 1, live.size() * 2));
+                    live[slot] = true;
+                }
+                return true;
+            });
+        }
+        liveBuilt.store(true, memory_order_release);
+    }
+
+    static string_view keyOf(const BinaryIndexEntry& e) {
+        return string_view(e.key, strnlen(e.key, sizeof(e.key)));
+    }
+
+    string_view keyAt(size_t i) const {
+        return mapped ? keyOf(mapped[i]) : string_view(indexList[i].id);
+    }
+
+    // Sort the list before a lookup if appends left it out of order.
+    // Lookups under a shared table lock can get here together: one sorts,
+    // the others wait for it instead of sorting the same vector at once.
+    void ensureSorted() {
+        if (sorted.load(memory_order_acquire))
+            return;
+        lock_guard<mutex> hold(sortLock);
+        if (!sorted.load(memory_order_relaxed))
+            sortIndex();
+    }
+
+    int binarySearch(const string& key) {
+        ensureSorted();
+
+        int low = 0, high = (int)size() - 1;
+
+        while (low <= high) {
+            int mid = (low + high) / 2;
+            string_view midKey = keyAt(mid);
+
+            if (midKey == key)
+                return mid;
+
+            if (midKey < key)
+                low = mid + 1;
+            else
+                high = mid - 1;
+        }
+        return -1;
+    }
+
+    void unmap() {
+        if (mapBase)
+            ::munmap(mapBase, mapLength);
+        mapBase = nullptr;
+        mapLength = 0;
+        mapped = nullptr;
+        mappedCount = 0;
+    }
+
+    // Copy the mapped entries into indexList so they can be modified
+    void materialize() {
+        if (!mapped)
+            return;
+
+        indexList.clear();
+        indexList.reserve(mappedCount);
+        for (size_t i = 0; i < mappedCount; i++)
+            indexList.push_back({ string(keyOf(mapped[i])), (long)mapped[i].offset });
+        unmap();
+    }
+
+    bool loadBinary() {
+        int fd = ::open(indexfile.c_str(), O_RDONLY);
+        if (fd == -1)
+            return false;
+        Stats::get().add(Stats::FileOpens);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PrimaryIndexHeader)) {
+            ::close(fd);
+            return false;
+        }
+
+        size_t length = (size_t)st.st_size;
+        void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+
+        const PrimaryIndexHeader* header = (const PrimaryIndexHeader*)p;
+        if (memcmp(header->magic, PrimaryIndexMagic, sizeof(header->magic)) != 0 ||
+            header->version != PrimaryIndexVersion ||
+            header->keyWidth != sizeof(BinaryIndexEntry::key) ||
+            length != sizeof(PrimaryIndexHeader) + header->count * sizeof(BinaryIndexEntry)) {
+            cout << "Error: " << indexfile << " is not a valid binary index!\n";
+            ::munmap(p, length);
+            return false;
+        }
+
+        indexList.clear();
+        sorted = true;
+        mapBase = p;
+        mapLength = length;
+        mapped = (const BinaryIndexEntry*)((const char*)p + sizeof(PrimaryIndexHeader));
+        mappedCount = header->count;
+        return true;
+    }
+
+    // Legacy "id|offset" text format
+    static bool readText(const string& filename, vector<IndexEntry>& entries) {
+        ifstream idx(filename);
+        if (!idx)
+            return false;
+
+        entries.clear();
+        string line;
+
+        while (getline(idx, line)) {
+            if (line.empty() || line == "\r")
+                continue;
+
+            stringstream ss(line);
+            string id, off;
+            getline(ss, id, '|');
+            getline(ss, off);
+
+            entries.push_back({ id, stol(off) });
+        }
+        idx.close();
+        return true;
+    }
+
+    static bool writeText(const string& filename, const vector<IndexEntry>& entries) {
+        ofstream idx(filename, ios::trunc);
+        if (!idx)
+            return false;
+
+        for (const auto& entry : entries)
+            idx << entry.id << "|" << entry.offset << "\n";
+        return (bool)idx;
+    }
+
+    // entries must already be sorted by id
+    static bool writeBinary(const string& filename, const vector<IndexEntry>& entries) {
+        ofstream idx(filename, ios::binary | ios::trunc);
+        if (!idx)
+            return false;
+
+        PrimaryIndexHeader header{};
+        memcpy(header.magic, PrimaryIndexMagic, sizeof(header.magic));
+        header.version = PrimaryIndexVersion;
+        header.keyWidth = sizeof(BinaryIndexEntry::key);
+        header.count = entries.size();
+        idx.write((const char*)&header, sizeof(header));
+
+        for (const auto& entry : entries) {
+            if (entry.id.size() > sizeof(BinaryIndexEntry::key)) {
+                cout << "Error: ID " << entry.id << " too long for binary index!\n";
+                return false;
+            }
+            BinaryIndexEntry e{};
+            memcpy(e.key, entry.id.data(), entry.id.size());
+            e.offset = entry.offset;
+            idx.write((const char*)&e, sizeof(e));
+        }
+        return (bool)idx;
+    }
+
+public:
+
+    PrimaryIndex(string idxFile, string srcFile)
+            : indexfile(idxFile), sourcefile(srcFile), delta(idxFile + ".delta") {
+        string suffix = indexfile.size() > 4 ? indexfile.substr(indexfile.size() - 4) : "";
+        string base = indexfile.substr(0, indexfile.size() - suffix.size());
+        if (suffix == ".bpt") {
+            tree.reset(new BPlusTree());
+            otherfile = base + ".idx";
+        } else if (suffix == ".idx") {
+            otherfile = base + ".bpt";
+        }
+    }
+
+    PrimaryIndex(const PrimaryIndex&) = delete;
+    PrimaryIndex& operator=(const PrimaryIndex&) = delete;
+
+    ~PrimaryIndex() {
+        unmap();
+    }
+
+    void attachLog(WriteAheadLog& log) {
+        delta.attach(log);
+    }
+
+    bool isDirty() const {
+        return dirty;
+    }
+
+    // Accepts both the binary format (mapped, no parsing) and the legacy
+    // text format, so old index files keep loading.
+    bool loadIndex() {
+        // The tree is read through its page cache on demand; nothing to reload
+        if (tree) {
+            if (!treeOpen)
+                treeOpen = tree->open(indexfile);
+            if (!treeOpen)
+                cout << "Error: Cannot open " << indexfile << "!\n";
+            else
+                loaded();
+            return treeOpen;
+        }
+
+        unmap();
+        if (loadBinary()) {
+            loaded();
+            return true;
+        }
+
+        if (!readText(indexfile, indexList)) {
+            cout << "Error: Index file missing!\n";
+            return false;
+        }
+        sorted = is_sorted(indexList.begin(), indexList.end(),
+                           [](const IndexEntry& a, const IndexEntry& b) {
+                               return a.id < b.id;
+                           });
+        loaded();
+        return true;
+    }
+
+
+    // loadIndex(), or a rebuild from the data file when there is no index
+    // file yet: the first run with this backend, or the other backend
+    // dropped it (see supersedeOther())
+    bool loadOrRebuild() {
+        if (!filesystem::exists(indexfile) && filesystem::exists(sourcefile))
+            return rebuild();
+        return loadIndex();
+    }
+
+    // Always writes the binary format, to a temp file put in place of the
+    // old one, and only if something changed. Returns false if the snapshot
+    // could not be written and synced. The delta log is kept until
+    // clearDelta(), so a checkpoint can cut the write-ahead log first.
+    bool saveIndex() {
+        if (!dirty)
+            return true;
+
+        // Only the pages dirtied since the last save are written, through
+        // the tree's page journal
+        if (tree) {
+            if (!tree->flush()) {
+                cout << "Error writing to " << indexfile << "!\n";
+                return false;
+            }
+            dirty = false;
+            return true;
+        }
+
+        // Sort to enable binary search; upsert keeps the list ordered so
+        // this only happens after out-of-order addToIndex calls
+        ensureSorted();
+
+        // A mapped snapshot keeps its old inode, so renaming over it is safe
+        string tmp = indexfile + ".tmp";
+        if (!writeBinary(tmp, indexList) || !replaceFile(tmp, indexfile)) {
+            cout << "Error writing to " << indexfile << "!\n";
+            return false;
+        }
+        dirty = false;
+        return true;
+    }
+
+    // Forget the changes since the last snapshot, once nothing can replay them
+    void clearDelta() {
+        delta.clear();
+    }
+
+    // Rebuild from the data file: every record with an ID (tombstoned ones
+    // too, their slots keep the ID for reuse) through an external sort, so
+    // the flat index is written without ever holding it all in memory.
+    bool rebuild(size_t memoryBudget = ExternalSorter::DefaultBudget, unsigned workers = 0) {
+        Stats::Timer timer(Stats::IndexRebuild);
+        PartitionedSorter sorter(indexfile, memoryBudget, workers);
+        bool scanned = scanLines(sourcefile, sorter.workers(), [&](unsigned worker, const string& line, long offset) {
+            size_t p1 = line.find('|');
+            size_t p2 = (p1 == string::npos) ? p1 : line.find('|', p1 + 1);
+            if (line.size() > 4 && p2 != string::npos && p2 > p1 + 1)
+                sorter.add(worker, line.substr(p1 + 1, p2 - p1 - 1), offset);
+        });
+        if (!scanned) {
+            cout << "Error: Cannot open " << sourcefile << "!\n";
+            return false;
+        }
+        Stats::get().addScan(sourcefile);
+
+        RecordFile& data = RecordFile::get(sourcefile);
+        auto isLiveAt = [&](long off) { return data.byteAt(off + 3) != '*'; };
+
+        // Equal keys arrive together; keep the live copy if there is one
+        IndexEntry pending{ "", -1 };
+        bool ok;
+
+        if (tree) {
+            tree.reset(new BPlusTree());
+            treeOpen = false;
+            string tmp = indexfile + ".tmp";
+            remove(tmp.c_str());
+            remove((tmp + ".journal").c_str());
+
+            BPlusTree fresh;
+            if (!fresh.open(tmp))
+                return false;
+            ok = sorter.merge([&](const string& id, long off) {
+                if (id == pending.id && !isLiveAt(off))
+                    return;
+                pending = { id, off };
+                fresh.upsert(id, off);
+            });
+            ok = fresh.flush() && ok;
+            fresh.close();
+            ok = ok && replaceFile(tmp, indexfile);
+        } else {
+            // Stream the binary format out, patching the count at the end
+            string tmp = indexfile + ".tmp";
+            ofstream idx(tmp, ios::binary | ios::trunc);
+            PrimaryIndexHeader header{};
+            memcpy(header.magic, PrimaryIndexMagic, sizeof(header.magic));
+            header.version = PrimaryIndexVersion;
+            header.keyWidth = sizeof(BinaryIndexEntry::key);
+            idx.write((const char*)&header, sizeof(header));
+
+            bool fits = true;
+            auto emit = [&]() {
+                if (pending.offset == -1)
+                    return;
+                if (pending.id.size() > sizeof(BinaryIndexEntry::key)) {
+                    cout << "Error: ID " << pending.id << " too long for binary index!\n";
+                    fits = false;
+                    return;
+                }
+                BinaryIndexEntry e{};
+                memcpy(e.key, pending.id.data(), pending.id.size());
+                e.offset = pending.offset;
+                idx.write((const char*)&e, sizeof(e));
+                header.count++;
+            };
+            ok = sorter.merge([&](const string& id, long off) {
+                if (id == pending.id) {
+                    if (isLiveAt(off))
+                        pending.offset = off;
+                    return;
+                }
+                emit();
+                pending = { id, off };
+            });
+            emit();
+
+            idx.seekp(0);
+            idx.write((const char*)&header, sizeof(header));
+            idx.close();
+            ok = ok && fits && (bool)idx && replaceFile(tmp, indexfile);
+        }
+
+        if (!ok) {
+            cout << "Error rebuilding " << indexfile << "!\n";
+            return false;
+        }
+        delta.clear();
+        return loadIndex();
+    }
+
+    // Converters between the legacy text format and the binary format
+    static bool convertTextToBinary(const string& textFile, const string& binaryFile) {
+        vector<IndexEntry> entries;
+        if (!readText(textFile, entries))
+            return false;
+        sort(entries.begin(), entries.end(),
+             [](const IndexEntry& a, const IndexEntry& b) {
+                 return a.id < b.id;
+             });
+        return writeBinary(binaryFile, entries);
+    }
+
+    static bool convertBinaryToText(const string& binaryFile, const string& textFile) {
+        PrimaryIndex idx(binaryFile, "");
+        if (!idx.loadBinary())
+            return false;
+        idx.materialize();
+        return writeText(textFile, idx.indexList);
+    }
+
+    size_t size() const {
+        if (tree)
+            return tree->size();
+        return mapped ? mappedCount : indexList.size();
+    }
+
+    // Ordered scan of IDs in [from, to] (to empty = open ended).
+    // f(id, offset) returns false to stop.
+    template <class F>
+    void rangeScan(const string& from, const string& to, F f) {
+        if (tree) {
+            tree->scan(from, to, f);
+            return;
+        }
+        ensureSorted();
+
+        size_t low = 0, high = size();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (keyAt(mid) < from)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        for (size_t i = low; i < size(); i++) {
+            string_view id = keyAt(i);
+            if (!to.empty() && id > to)
+                return;
+            long offset = mapped ? (long)mapped[i].offset : indexList[i].offset;
+            if (!f(id, offset))
+                return;
+        }
+    }
+
+    template <class F>
+    void forEach(F f) {
+        rangeScan("", "", f);
+    }
+
+    long indexByID(const string& keyID) {
+        Stats::Timer timer(Stats::IndexLookup);
+        if (tree)
+            return tree->find(keyID);
+
+        int pos = binarySearch(keyID);
+
+        if (pos == -1)
+            return -1; // Not found
+
+        // Just return the beginning of the record
+        return mapped ? (long)mapped[pos].offset : indexList[pos].offset;
+    }
+
+    // Served from the record cache; misses read the mapped data file
+    shared_ptr<const CachedRecord> cachedRecordAt(long offset) {
+        Stats::Timer timer(Stats::RecordRead);
+        return RecordCache::get().read(sourcefile, offset);
+    }
+
+    string readRecordAtOffset(long offset) {
+        if (offset < 0)
+            return "Record not found";
+
+        if (!RecordFile::get(sourcefile).isOpen())
+            return "Source file missing!";
+
+        auto record = cachedRecordAt(offset);
+        return record ? record->line : string();
+    }
+
+    // True if id is indexed and its record is not tombstoned. Numeric IDs
+    // are answered from the liveness bitmap with no I/O; anything else falls
+    // back to an index lookup and a look at the record's delete flag.
+    bool isLive(const string& id) {
+        long slot = slotOf(id);
+        if (slot >= 0) {
+            ensureLiveness();
+            return (size_t)slot < live.size() && live[slot];
+        }
+
+        long offset = indexByID(id);
+        if (offset == -1)
+            return false;
+        auto record = cachedRecordAt(offset);
+        return record && record->line.size() > 3 && !record->deleted;
+    }
+
+    // Called once the record behind id has been tombstoned
+    void markDeleted(const string& id) {
+        setLive(id, false);
+    }
+
+    // Insert id at its sorted position, or re-point it if already present.
+    // O(log n) to find the slot plus one shift, instead of a full re-sort.
+    // The record at offset is taken to be live. Recorded in the delta log;
+    // the snapshot is written by the next checkpoint.
+    void upsert(const string& id, long offset) {
+        put(id, offset);
+        delta.append("+ " + id + " " + to_string(offset));
+    }
+
+    void erase(const string& id) {
+        drop(id);
+        delta.append("- " + id);
+    }
+
+    // erase() for many IDs at once: one pass over the list instead of a
+    // vector erase per ID
+    void eraseMany(vector<string> ids) {
+        if (ids.empty())
+            return;
+        for (const string& id : ids)
+            delta.append("- " + id);
+        if (tree) {
+            for (const string& id : ids)
+                drop(id);
+            return;
+        }
+
+        supersedeOther();
+        for (const string& id : ids)
+            setLive(id, false);
+        dirty = true;
+        materialize();
+        ensureSorted();
+        sort(ids.begin(), ids.end());
+        indexList.erase(remove_if(indexList.begin(), indexList.end(),
+                                  [&](const IndexEntry& e) {
+                                      return binary_search(ids.begin(), ids.end(), e.id);
+                                  }),
+                        indexList.end());
+    }
+
+    // Unordered append for bulk loads; the list is sorted once on the next
+    // lookup or save. Not logged: the bulk loader saves the snapshot itself.
+    void addToIndex(const string& id, long offset) {
+        supersedeOther();
+        setLive(id, true);
+        dirty = true;
+        if (tree) {
+            tree->upsert(id, offset);
+            return;
+        }
+
+        materialize();
+        if (sorted && !indexList.empty() && id < indexList.back().id)
+            sorted = false;
+        indexList.push_back({ id, offset });
+    }
+
+    // Sort the index vector by ID
+    void sortIndex() {
+        if (tree)
+            return;
+
+        materialize();
+        sort(indexList.begin(), indexList.end(),
+             [](const IndexEntry& a, const IndexEntry& b) {
+                 return a.id < b.id;
+             });
+        sorted = true;
+    }
+};
+
+struct FreeSlot
+{
+    long offset;
+    int length;
+};
+
+// ====================== Free Space Manager ======================
+// Holes left by deleted records in one data file. A hole is a tombstoned
+// ('*') record: `length` bytes followed by its line terminator. Holes are
+// indexed by size, for best-fit allocation in O(log n), and by offset, so a
+// newly freed record can be merged with the holes right before and after it.
+//
+// One instance per table lives in Database and is shared by Insert and
+// DeleteManager. The state is kept in memory; the avail file is an
+// append-only log written behind the changes:
+//     offset length      hole added (the original avail-list line format)
+//     - offset length    hole removed
+// Pending lines are appended in batches and the log is rewritten from the
+// in-memory state once it grows well past the number of live holes.
+class FreeSpaceManager
+{
+private:
+    // The 3-digit length header doesn't count its own 3 bytes
+    static const int MaxHoleLength = 999 + 3;
+    // Smallest tombstone that still parses: "NNN*||"
+    static const int MinHoleLength = 6;
+    // Pending log lines that trigger a write
+    static const size_t FlushThreshold = 32;
+    // Log lines allowed before compaction, beyond 2x the live holes
+    static const size_t CompactSlack = 64;
+
+    string datafile;
+    string availfile;
+    WriteAheadLog& wal;
+    multimap<int, long> bySize;     // length -> offset
+    map<long, int> byOffset;        // offset -> length
+
+    string pending;
+    size_t pendingLines = 0;
+    size_t logLines = 0;
+
+    void logChange(bool added, long offset, int length)
+    {
+        if (!added) pending += "- ";
+        pending += to_string(offset) + " " + to_string(length) + "\n";
+        if (++pendingLines >= FlushThreshold)
+            flush();
+    }
+
+    void insertHole(long offset, int length)
+    {
+        bySize.insert({ length, offset });
+        byOffset[offset] = length;
+        logChange(true, offset, length);
+    }
+
+    void eraseHole(long offset)
+    {
+        auto it = byOffset.find(offset);
+        if (it == byOffset.end()) return;
+        logChange(false, offset, it->second);
+
+        auto range = bySize.equal_range(it->second);
+        for (auto s = range.first; s != range.second; ++s)
+        {
+            if (s->second == offset)
+            {
+                bySize.erase(s);
+                break;
+            }
+        }
+        byOffset.erase(it);
+    }
+
+    static string lengthHeader(int length)
+    {
+        string s = to_string(length - 3);
+        return string(3 - s.length(), '0') + s;
+    }
+
+    // Size of the line terminator at `end` (\n or \r\n), 0 if there is none
+    int terminatorAt(long end)
+    {
+        RecordFile& data = RecordFile::get(datafile);
+        int c = data.byteAt(end);
+        if (c == '\n') return 1;
+        if (c == '\r' && data.byteAt(end + 1) == '\n') return 2;
+        return 0;
+    }
+
+    string idAt(long offset)
+    {
+        string_view record = RecordFile::get(datafile).view(offset);
+        size_t p1 = record.find('|');
+        size_t p2 = record.find('|', p1 + 1);
+        if (p1 == string_view::npos || p2 == string_view::npos) return "";
+        return string(record.substr(p1 + 1, p2 - p1 - 1));
+    }
+
+    // The file really has a tombstone of this length at offset
+    bool holeOnDisk(long offset, int length)
+    {
+        string_view record = RecordFile::get(datafile).view(offset);
+        return record.size() == (size_t)length && length >= 4 && record[3] == '*' &&
+               record.substr(0, 3) == lengthHeader(length) && terminatorAt(offset + length) > 0;
+    }
+
+    // Part of the caller's transaction; reads of the data file during the
+    // same transaction still see the old bytes
+    void writeAt(long offset, const string& bytes)
+    {
+        wal.write(datafile, offset, bytes);
+    }
+
+public:
+    FreeSpaceManager(const string& dataFile, const string& availFile, WriteAheadLog& log)
+            : datafile(dataFile), availfile(availFile), wal(log) {
+    }
+
+    FreeSpaceManager(const FreeSpaceManager&) = delete;
+    FreeSpaceManager& operator=(const FreeSpaceManager&) = delete;
+
+    ~FreeSpaceManager() { flush(); }
+
+    // Replay the avail log. Holes whose record isn't tombstoned any more
+    // (a removal that never reached the log) are dropped, so a lost
+    // write-behind batch can leak space but never hand out a live record.
+    void load()
+    {
+        bySize.clear();
+        byOffset.clear();
+        pending.clear();
+        pendingLines = 0;
+        logLines = 0;
+
+        ifstream file(availfile);
+        if (!file) return;
+
+        map<long, int> holes;
+        string line;
+        while (getline(file, line))
+        {
+            stringstream ss(line);
+            string first;
+            long offset;
+            int length;
+            if (!(ss >> first)) continue;
+            logLines++;
+
+            if (first == "-")
+            {
+                if (ss >> offset >> length) holes.erase(offset);
+            }
+            else if (ss >> length)
+                holes[stol(first)] = length;
+        }
+
+        long coveredTo = 0;
+        for (auto& h : holes)
+        {
+            if (h.first < coveredTo || !holeOnDisk(h.first, h.second)) continue;
+            bySize.insert({ h.second, h.first });
+            byOffset[h.first] = h.second;
+            coveredTo = h.first + h.second;
+        }
+    }
+
+    // Rebuild from the tombstones in the data file and rewrite the log.
+    // Used after log recovery, when write-behind lines may have been lost.
+    void rebuild()
+    {
+        bySize.clear();
+        byOffset.clear();
+
+        ifstream file(datafile, ios::binary);
+        string line;
+        long offset = 0;
+        while (getline(file, line))
+        {
+            long next = file.tellg();
+            int length = (int)line.size();
+            if (length > 0 && line[length - 1] == '\r') length--;
+            if (next != -1 && length >= MinHoleLength && holeOnDisk(offset, length))
+            {
+                bySize.insert({ length, offset });
+                byOffset[offset] = length;
+            }
+            offset = (next != -1) ? next : offset + line.length() + 1;
+        }
+        compact();
+    }
+
+    // Append the pending log lines, compacting the log if it has grown
+    void flush()
+    {
+        if (pendingLines == 0) return;
+
+        logLines += pendingLines;
+        if (logLines > 2 * byOffset.size() + CompactSlack)
+        {
+            compact();
+            return;
+        }
+
+        ofstream file(availfile, ios::app);
+        file << pending;
+        pending.clear();
+        pendingLines = 0;
+    }
+
+    // Rewrite the log as just the live holes (write temp, then replace)
+    void compact()
+    {
+        string tmp = availfile + ".tmp";
+        bool written;
+        {
+            ofstream file(tmp, ios::trunc);
+            for (auto& h : byOffset)
+                file << h.first << " " << h.second << "\n";
+            written = (bool)file.flush();
+        }
+        // The old log stays in place if the new one didn't make it; its
+        // extra holes are checked against the data file on load()
+        if (!written || !replaceFile(tmp, availfile))
+        {
+            cout << "Error writing to " << availfile << "!\n";
+            return;
+        }
+
+        pending.clear();
+        pendingLines = 0;
+        logLines = byOffset.size();
+    }
+
+    vector<FreeSlot> slots() const
+    {
+        vector<FreeSlot> v;
+        for (auto& h : byOffset)
+            v.push_back({ h.first, (int)h.second });
+        return v;
+    }
+
+    bool empty() const { return byOffset.empty(); }
+
+    // Drop every hole; compaction is about to remove the tombstones
+    void clear()
+    {
+        bySize.clear();
+        byOffset.clear();
+        compact();
+    }
+
+    // Drop the hole at offset if there is one (its tombstone is gone)
+    void forget(long offset)
+    {
+        if (byOffset.count(offset))
+            eraseHole(offset);
+    }
+
+    // Put back a hole handed out by allocate() that the caller couldn't use
+    void restore(long offset, int length)
+    {
+        writeAt(offset, lengthHeader(length));
+        insertHole(offset, length);
+    }
+
+    // Take the smallest hole of at least `required` bytes. If the leftover
+    // is big enough to stand on its own it is split off as a new hole, so
+    // `length` comes back as exactly `required`; otherwise it is the whole
+    // hole and the caller pads its record to fill it.
+    bool allocate(int required, long& offset, int& length)
+    {
+        auto it = bySize.lower_bound(required);
+        if (it == bySize.end()) return false;
+
+        offset = it->second;
+        length = it->first;
+        eraseHole(offset);
+
+        int rest = length - required - 1;   // one byte for the new '\n'
+        if (rest >= MinHoleLength)
+        {
+            string filler = lengthHeader(rest) + "*||" + string(rest - MinHoleLength, ' ');
+            writeAt(offset + required, "\n" + filler);
+            insertHole(offset + required + 1, rest);
+            length = required;
+        }
+        return true;
+    }
+
+    // Register the just-tombstoned record [offset, offset + length) as a hole,
+    // merging it with adjacent holes. Returns the IDs of records whose
+    // headers were absorbed into a neighbour; they no longer exist and must
+    // be dropped from the primary index.
+    vector<string> release(long offset, int length)
+    {
+        vector<string> retired;
+        long start = offset;
+        int len = length;
+
+        auto next = byOffset.upper_bound(offset);
+        if (next != byOffset.end())
+        {
+            int term = terminatorAt(start + len);
+            long nextOffset = next->first;
+            int nextLength = next->second;
+            if (term > 0 && start + len + term == nextOffset &&
+                nextOffset + nextLength - start <= MaxHoleLength)
+            {
+                string id = idAt(nextOffset);
+                if (!id.empty()) retired.push_back(id);
+                eraseHole(nextOffset);
+                writeAt(start + len, string(term, ' '));
+                len = (int)(nextOffset + nextLength - start);
+            }
+        }
+
+        auto prev = byOffset.lower_bound(offset);
+        if (prev != byOffset.begin())
+        {
+            --prev;
+            long prevOffset = prev->first;
+            int prevLength = prev->second;
+            int term = terminatorAt(prevOffset + prevLength);
+            if (term > 0 && prevOffset + prevLength + term == start &&
+                start + len - prevOffset <= MaxHoleLength)
+            {
+                string id = idAt(start);
+                if (!id.empty()) retired.push_back(id);
+                eraseHole(prevOffset);
+                writeAt(prevOffset + prevLength, string(term, ' '));
+                len = (int)(start + len - prevOffset);
+                start = prevOffset;
+            }
+        }
+
+        // The surviving tombstone's header must cover the merged span
+        if (start != offset || len != length)
+            writeAt(start, lengthHeader(len));
+
+        insertHole(start, len);
+        return retired;
+    }
+};
+
+// ====================== ID Sequence ======================
+// High-water mark of the IDs handed out for one table, kept in a one-line
+// metadata file, so picking the next ID is O(1) instead of a scan of the
+// data file.
+class IdSequence
+{
+private:
+    string seqfile;
+    long last = 0;
+
+public:
+    explicit IdSequence(const string& file) : seqfile(file) {}
+
+    // IDs are at least two digits: 01, 02, ..., 99, 100
+    static string formatID(long id)
+    {
+        string s = to_string(id);
+        if (s.length() == 1) s = "0" + s;
+        return s;
+    }
+
+    bool save() const
+    {
+        string tmp = seqfile + ".tmp";
+        {
+            ofstream file(tmp, ios::trunc);
+            file << last << "\n";
+            if (!file.flush())
+                return false;
+        }
+        return replaceFile(tmp, seqfile);
+    }
+
+    long current() const { return last; }
+
+    // Read the mark. If it is missing or behind the index (a crash between
+    // writing a record and the mark), recover it from the largest ID in the
+    // primary index.
+    void load(PrimaryIndex& index)
+    {
+        last = -1;
+        ifstream file(seqfile);
+        if (file)
+            file >> last;
+
+        if (last >= 0 && index.indexByID(formatID(last + 1)) == -1)
+            return;
+
+        last = 0;
+        index.forEach([&](string_view id, long) {
+            long value = strtol(string(id).c_str(), nullptr, 10);
+            if (value > last) last = value;
+            return true;
+        });
+        save();
+    }
+
+    // Hand out the next ID. The mark is persisted by the next checkpoint;
+    // load() recovers it from the index if that never happened.
+    string next(PrimaryIndex& index)
+    {
+        last++;
+        // Guard against a mark that lags records written by older builds
+        while (index.indexByID(formatID(last)) != -1)
+            last++;
+        return formatID(last);
+    }
+
+    // Bulk loads: move the mark past every ID already in the index once, so
+    // take() can hand out consecutive IDs without probing. The caller
+    // persists the mark with save() when done.
+    void skipPast(PrimaryIndex& index)
+    {
+        index.forEach([&](string_view id, long) {
+            long value = strtol(string(id).c_str(), nullptr, 10);
+            if (value > last) last = value;
+            return true;
+        });
+    }
+
+    // The ID the next take() returns, for validating a record before
+    // committing to it
+    string peek() const
+    {
+        return formatID(last + 1);
+    }
+
+    string take()
+    {
+        return formatID(++last);
+    }
+};
+
+// ====================== Compaction ======================
+// Rewrites one data file without its tombstones, in place and a segment at
+// a time. Everything before writeCursor is compacted, everything from
+// readCursor on is untouched, and the gap between them is covered by
+// filler tombstones so the file stays readable between segments. Each
+// step() is one log transaction: it moves the live records of the next
+// segment down to writeCursor, re-points the primary index (and, through
+// `moved`, the secondary index) at their new offsets, and drops index
+// entries of the tombstones it skips. The last step truncates the file.
+//
+// Holes are cleared when a run starts, so inserts during the run append
+// at the end (and get compacted later in the run). Records deleted in the
+// not yet compacted part are dropped from the free-space manager as the
+// run passes them. A run that stops early leaves the fillers and the old
+// tombstones only in the file, so stop() rebuilds the holes from it; a
+// marker file left by a run the process never finished has recover() do
+// the same on the next open.
+class Compactor
+{
+private:
+    // Smallest filler: "NNN*||\n"
+    static const int MinFiller = 7;
+    static const int MaxFiller = 999 + 3 + 1;
+
+    string datafile;
+    string markerfile;          // exists while a run is in progress
+    PrimaryIndex& index;
+    FreeSpaceManager& space;
+    WriteAheadLog& wal;
+    function<void(const string& record, long from, long to)> moved;
+
+    long readCursor = 0;
+    long writeCursor = 0;
+    bool running = false;
+    long reclaimed = 0;
+
+    static string lengthHeader(int length)
+    {
+        string s = to_string(length - 3);
+        return string(3 - s.length(), '0') + s;
+    }
+
+    static string idOf(string_view record)
+    {
+        size_t p1 = record.find('|');
+        size_t p2 = record.find('|', p1 + 1);
+        if (p1 == string_view::npos || p2 == string_view::npos) return "";
+        return string(record.substr(p1 + 1, p2 - p1 - 1));
+    }
+
+    // Tombstone lines covering exactly `gap` bytes (gap is 0 or >= MinFiller)
+    static string filler(long gap)
+    {
+        string out;
+        while (gap > 0)
+        {
+            long chunk = min<long>(gap, MaxFiller);
+            if (gap - chunk > 0 && gap - chunk < MinFiller)
+                chunk = gap - MinFiller;
+            int length = (int)chunk - 1;
+            out += lengthHeader(length) + "*||" + string(length - 6, ' ') + "\n";
+            gap -= chunk;
+        }
+        return out;
+    }
+
+public:
+    Compactor(const string& dataFile, PrimaryIndex& primary, FreeSpaceManager& freeSpace,
+              WriteAheadLog& log, function<void(const string&, long, long)> onMove)
+            : datafile(dataFile), markerfile(dataFile + ".compacting"), index(primary), space(freeSpace),
+              wal(log), moved(onMove) {
+    }
+
+    bool isRunning() const { return running; }
+    long bytesReclaimed() const { return reclaimed; }
+
+    // The marker is on disk before the holes are cleared
+    void start()
+    {
+        readCursor = writeCursor = 0;
+        reclaimed = 0;
+        running = true;
+        {
+            ofstream marker(markerfile, ios::trunc);
+        }
+        string dir = filesystem::path(markerfile).parent_path().string();
+        syncPath(dir.empty() ? "." : dir, true);
+        space.clear();
+    }
+
+    // End a run between segments
+    void stop()
+    {
+        if (!running) return;
+        running = false;
+        space.rebuild();
+        ::unlink(markerfile.c_str());
+    }
+
+    // At open, after the log replay: a run cut short by a crash
+    void recover()
+    {
+        if (!filesystem::exists(markerfile)) return;
+        space.rebuild();
+        ::unlink(markerfile.c_str());
+    }
+
+    // Compact roughly `budget` more bytes. Returns true once the file is done.
+    bool step(size_t budget)
+    {
+        if (!running) return true;
+
+        RecordFile& data = RecordFile::get(datafile);
+        error_code ec;
+        long end = (long)filesystem::file_size(datafile, ec);
+        if (ec) end = 0;
+
+        wal.begin();
+        string out;
+        long r = readCursor;
+        long w = writeCursor;
+        size_t scanned = 0;
+        vector<string> dropped;
+
+        // Stop on budget, but never with a gap too small for a filler
+        while (r < end)
+        {
+            long gap = r - (w + (long)out.size());
+            if (scanned >= budget && (gap == 0 || gap >= MinFiller)) break;
+
+            string_view record = data.view(r);
+            long raw = record.size();
+            if (data.byteAt(r + raw) == '\r') raw++;
+            if (data.byteAt(r + raw) == '\n') raw++;
+            if (raw == 0) break;
+            scanned += raw;
+
+            if (record.empty() || (record.size() >= 4 && record[3] == '*'))
+            {
+                // Dead: drop it with whatever still refers to it
+                space.forget(r);
+                string id = idOf(record);
+                if (!id.empty() && index.indexByID(id) == r)
+                    dropped.push_back(id);
+            }
+            else if (r == w + (long)out.size() && out.empty())
+            {
+                // Nothing dropped yet: the record stays where it is
+                w += raw;
+            }
+            else
+            {
+                long to = w + (long)out.size();
+                string line(record);
+                out += line;
+                out += '\n';
+
+                string id = idOf(record);
+                if (!id.empty() && index.indexByID(id) == r)
+                    index.upsert(id, to);
+                moved(line, r, to);
+            }
+            r += raw;
+        }
+
+        index.eraseMany(dropped);
+        if (!out.empty())
+            wal.write(datafile, w, out);
+        w += out.size();
+
+        bool done = r >= end;
+        if (done)
+        {
+            if (w < end)
+                wal.truncateFile(datafile, w);
+        }
+        else if (r > w)
+            wal.write(datafile, w, filler(r - w));
+
+        wal.commit();
+
+        reclaimed += (r - readCursor) - (w - writeCursor);
+        readCursor = done ? w : r;
+        writeCursor = w;
+        running = !done;
+        if (done)
+            ::unlink(markerfile.c_str());
+        return done;
+    }
+};
+
+// ====================== Database ======================
+// How a command uses one table
+enum class Access { None, Read, Write };
+
+// The locks one command holds, released together when it goes out of scope.
+// A writer first waits for its transactions to be logged and applied, with
+// only the writer lock already free for the next commands.
+struct TableLocks
+{
+    unique_lock<mutex> writer;
+    unique_lock<shared_mutex> doctorsWrite;
+    shared_lock<shared_mutex> doctorsRead;
+    unique_lock<shared_mutex> appointmentsWrite;
+    shared_lock<shared_mutex> appointmentsRead;
+    WriteAheadLog* log = nullptr;
+
+    TableLocks() = default;
+    TableLocks(TableLocks&&) = default;
+    TableLocks& operator=(TableLocks&&) = default;
+
+    ~TableLocks() { release(); }
+
+    // Let go of the locks now. Returns false if a transaction committed
+    // under them could not be synced to the log or applied.
+    bool release()
+    {
+        bool durable = true;
+        if (writer.owns_lock())
+        {
+            // The records are queued; the tables stay locked until the
+            // writes are in the data files
+            writer.unlock();
+            durable = !log || log->waitDurable();
+        }
+        if (appointmentsRead.owns_lock()) appointmentsRead.unlock();
+        if (appointmentsWrite.owns_lock()) appointmentsWrite.unlock();
+        if (doctorsRead.owns_lock()) doctorsRead.unlock();
+        if (doctorsWrite.owns_lock()) doctorsWrite.unlock();
+        return durable;
+    }
+};
+
+// Owns the state that belongs to the open data files: the write-ahead log,
+// the primary and secondary indexes and the per-table free-space managers
+// shared by Insert and DeleteManager.
+//
+// Each table (doctors: doctorIndex, secName, doctorsSpace, doctorIds;
+// appointments: appIndex, secID, appointmentsSpace, appointmentIds) has a
+// reader/writer lock. A command holds lock() on the tables it touches for
+// as long as it runs: any number of readers share a table, a writer has it
+// to itself. Writers also take the writer lock, which puts their log records
+// in one order. They let it go once their record is queued and keep the
+// table locks until the log sync has applied their writes, so writers of
+// different tables share syncs, and nobody reads a change before it is
+// durable. Insert's appointment path reads doctors
+// and writes appointments; every other mutation stays within one table.
+//
+// A background thread checkpoints under exclusive(): after
+// CheckpointMutations committed transactions, every CheckpointSeconds, or
+// once the log passes CheckpointLogBytes; close() takes a final one. A
+// checkpoint saves the dirty indexes (which empties their delta logs) and
+// truncates the log.
+class Database
+{
+private:
+    static const int CheckpointSeconds = 30;
+    static const size_t CheckpointMutations = 256;
+    static const size_t CheckpointLogBytes = 4 << 20;
+    // Bytes of data file per compaction step (one lock hold)
+    static const size_t CompactionSegment = 64 << 10;
+
+    mutex writerLock;
+    shared_mutex doctorsLock;
+    shared_mutex appointmentsLock;
+    mutex wakeLock;
+    condition_variable wake;
+    bool closing = false;
+    thread checkpointer;
+
+    thread compactionThread;
+    atomic<bool> compactionActive{ false };
+    atomic<bool> stopCompaction{ false };
+
+    // Both files, one segment per lock hold so other commands get in between
+    void runCompaction()
+    {
+        bool done = false;
+        while (!done && !stopCompaction)
+        {
+            TableLocks hold = lock(Access::Write, Access::None);
+            done = doctorsCompactor.step(CompactionSegment);
+        }
+        done = false;
+        while (!done && !stopCompaction)
+        {
+            TableLocks hold = lock(Access::None, Access::Write);
+            done = appointmentsCompactor.step(CompactionSegment);
+        }
+
+        if (stopCompaction)
+        {
+            TableLocks hold = exclusive();
+            doctorsCompactor.stop();
+            appointmentsCompactor.stop();
+        }
+        else
+        {
+            TableLocks hold = exclusive();
+            cout << "\nCompaction finished, " << doctorsCompactor.bytesReclaimed() << " bytes reclaimed from doctors.txt and "
+                 << appointmentsCompactor.bytesReclaimed() << " from appointments.txt.\n";
+        }
+        compactionActive = false;
+    }
+
+    void runCheckpointer()
+    {
+        auto lastCheckpoint = chrono::steady_clock::now();
+        unique_lock<mutex> lock(wakeLock);
+        while (!closing)
+        {
+            wake.wait_for(lock, chrono::seconds(1));
+            if (closing) break;
+
+            bool due = chrono::steady_clock::now() - lastCheckpoint >= chrono::seconds(CheckpointSeconds);
+            if (!due && wal.transactions() < CheckpointMutations && wal.size() < CheckpointLogBytes)
+                continue;
+
+            lock.unlock();
+            {
+                TableLocks hold = exclusive();
+                checkpoint();
+            }
+            lastCheckpoint = chrono::steady_clock::now();
+            lock.lock();
+        }
+    }
+
+public:
+    WriteAheadLog wal;
+    PrimaryIndex appIndex;
+    PrimaryIndex doctorIndex;
+    SecondaryIndexDoctorID secID;
+    SecondaryIndexDoctorName secName;
+    FreeSpaceManager doctorsSpace;
+    FreeSpaceManager appointmentsSpace;
+    IdSequence doctorIds;
+    IdSequence appointmentIds;
+    Compactor doctorsCompactor;
+    Compactor appointmentsCompactor;
+
+    Database(const string& appIndexFile, const string& docIndexFile)
+            : wal("database.wal"),
+              appIndex(appIndexFile, "appointments.txt"),
+              doctorIndex(docIndexFile, "doctors.txt"),
+              secID("SecondryIndex_DoctorId_App.txt", "appointments.txt"),
+              secName("SecondryIndex_DoctorName.txt", "doctors.txt"),
+              doctorsSpace("doctors.txt", "doctorsAvailList.txt", wal),
+              appointmentsSpace("appointments.txt", "appointmentsAvailList.txt", wal),
+              doctorIds("doctorsSequence.txt"),
+              appointmentIds("appointmentsSequence.txt"),
+              doctorsCompactor("doctors.txt", doctorIndex, doctorsSpace, wal,
+                               [this](const string& record, long from, long to) {
+                                   string name;
+                                   if (!SecondaryIndexDoctorName::parseRecord(record, name)) return;
+                                   secName.moveEntry(name, from, to);
+                               }),
+              appointmentsCompactor("appointments.txt", appIndex, appointmentsSpace, wal,
+                                    [this](const string& record, long from, long to) {
+                                        string appID, doctorID;
+                                        if (!SecondaryIndexDoctorID::parseRecord(record, appID, doctorID)) return;
+                                        secID.moveEntry(doctorID, appID, from, to);
+                                    }) {
+        appIndex.attachLog(wal);
+        doctorIndex.attachLog(wal);
+        secID.attachLog(wal);
+        secName.attachLog(wal);
+    }
+
+    ~Database() { close(); }
+
+    void open()
+    {
+        // Committed changes the last run didn't checkpoint go back into the
+        // data files before anything reads them
+        wal.open();
+        long replayed = wal.recover();
+
+        if (replayed > 0)
+            cout << "Recovered " << replayed << " transactions from the log.\n";
+
+        // Each index loads its snapshot and replays its delta log
+        appIndex.loadOrRebuild();
+        doctorIndex.loadOrRebuild();
+
+        // Secondary indexes are maintained incrementally by the managers; a full
+        // scan of the data files only happens when the saved index can't be trusted.
+        // The replay just touched the data files, so timestamps say nothing then.
+        if (!secID.loadIndex() || (replayed == 0 && secID.isStale()))
+            secID.createIndex();
+        if (!secName.loadIndex() || (replayed == 0 && secName.isStale()))
+            secName.createIndex();
+
+        if (replayed > 0)
+        {
+            doctorsSpace.rebuild();
+            appointmentsSpace.rebuild();
+        }
+        else
+        {
+            doctorsSpace.load();
+            appointmentsSpace.load();
+        }
+        doctorsCompactor.recover();
+        appointmentsCompactor.recover();
+
+        doctorIds.load(doctorIndex);
+        appointmentIds.load(appIndex);
+
+        if (replayed > 0 || dirty())
+            checkpoint();
+
+        closing = false;
+        checkpointer = thread(&Database::runCheckpointer, this);
+    }
+
+    // Tables are always locked doctors first, then appointments, so two
+    // commands can't deadlock
+    TableLocks lock(Access doctors, Access appointments)
+    {
+        TableLocks held;
+        if (doctors == Access::Write || appointments == Access::Write)
+        {
+            held.writer = unique_lock<mutex>(writerLock);
+            held.log = &wal;
+        }
+        if (doctors == Access::Write)
+            held.doctorsWrite = unique_lock<shared_mutex>(doctorsLock);
+        else if (doctors == Access::Read)
+            held.doctorsRead = shared_lock<shared_mutex>(doctorsLock);
+        if (appointments == Access::Write)
+            held.appointmentsWrite = unique_lock<shared_mutex>(appointmentsLock);
+        else if (appointments == Access::Read)
+            held.appointmentsRead = shared_lock<shared_mutex>(appointmentsLock);
+        return held;
+    }
+
+    // Both tables to itself: checkpoints, rebuilds, the interactive menu
+    TableLocks exclusive()
+    {
+        return lock(Access::Write, Access::Write);
+    }
+
+    bool dirty() const
+    {
+        return appIndex.isDirty() || doctorIndex.isDirty() || secID.isDirty() || secName.isDirty();
+    }
+
+    // Save everything the log covers, then drop the log. Each snapshot is
+    // synced and renamed into place first; only once all of them are on
+    // disk does the log go, and after it the delta logs. If anything fails
+    // the log stays, so a crash still replays it. Caller holds exclusive().
+    void checkpoint()
+    {
+        if (wal.size() == 0 && !dirty()) return;
+
+        bool ok = wal.syncDataFiles();
+        ok = appIndex.saveIndex() && ok;
+        ok = doctorIndex.saveIndex() && ok;
+        ok = secID.saveIndex() && ok;
+        ok = secName.saveIndex() && ok;
+        doctorsSpace.flush();
+        appointmentsSpace.flush();
+        ok = doctorIds.save() && ok;
+        ok = appointmentIds.save() && ok;
+        if (!ok)
+        {
+            cout << "Error: Checkpoint incomplete, keeping the log.\n";
+            return;
+        }
+
+        wal.truncate();
+        appIndex.clearDelta();
+        doctorIndex.clearDelta();
+        secID.clearDelta();
+        secName.clearDelta();
+    }
+
+    // Compact both data files on a background thread. Returns false if a
+    // run is already in progress. The caller holds exclusive(), so the holes
+    // are gone before the next insert could reuse one.
+    bool startCompaction()
+    {
+        if (compactionActive) return false;
+        if (compactionThread.joinable()) compactionThread.join();
+        doctorsCompactor.start();
+        appointmentsCompactor.start();
+        compactionActive = true;
+        stopCompaction = false;
+        compactionThread = thread(&Database::runCompaction, this);
+        return true;
+    }
+
+    // Run a compaction and wait for it (still one segment per lock hold)
+    void compactNow()
+    {
+        {
+            TableLocks hold = exclusive();
+            if (!startCompaction()) return;
+        }
+        compactionThread.join();
+    }
+
+    // Final checkpoint; write out whatever is still buffered. A compaction
+    // still running is stopped between segments.
+    void close()
+    {
+        if (compactionThread.joinable())
+        {
+            stopCompaction = true;
+            compactionThread.join();
+        }
+
+        if (checkpointer.joinable())
+        {
+            {
+                lock_guard<mutex> lock(wakeLock);
+                closing = true;
+            }
+            wake.notify_all();
+            checkpointer.join();
+        }
+
+        {
+            TableLocks hold = exclusive();
+            checkpoint();
+        }
+        doctorsSpace.flush();
+        appointmentsSpace.flush();
+        wal.close();
+    }
+};
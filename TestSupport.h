@@ -0,0 +1,80 @@
+// Shared by the test programs. Each one runs in a scratch directory,
+// reports failed checks on stderr and exits non-zero if any failed.
+#pragma once
+
+#include "Generator.h"
+
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+struct NullBuffer : streambuf
+{
+    int overflow(int c) override { return c; }
+};
+
+inline bool check(bool condition, const string& what)
+{
+    if (!condition)
+        cerr << "FAILED: " << what << "\n";
+    return condition;
+}
+
+// A fresh directory under the system temp directory, made current
+inline filesystem::path enterScratch(const string& name)
+{
+    filesystem::path dir = filesystem::temp_directory_path() / ("hms_" + name + "_" + to_string(getpid()));
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    filesystem::current_path(dir);
+    return dir;
+}
+
+inline void leaveScratch(const filesystem::path& dir)
+{
+    filesystem::current_path(filesystem::temp_directory_path());
+    filesystem::remove_all(dir);
+}
+
+// Crash injection. The storage classes sync data through fdatasync() (see
+// syncFile()), and this definition takes the place of libc's in the test
+// programs. Set crashAfterSyncs() to n and the process dies right after the
+// n-th sync from then on returns, as if the power went out before the next
+// write reached the disk.
+inline atomic<int>& crashAfterSyncs()
+{
+    static atomic<int> remaining{ 0 };
+    return remaining;
+}
+
+extern "C" int fdatasync(int fd)
+{
+    int result = (int)::syscall(SYS_fdatasync, fd);
+    if (crashAfterSyncs() > 0 && --crashAfterSyncs() == 0)
+        ::_exit(0);
+    return result;
+}
+
+// Run f in a child process, so it can crash (or just stop) without cleaning
+// up. The parent must not have started any threads yet. Returns false if the
+// child failed in any other way.
+template <class F>
+bool inChild(F f)
+{
+    cout.flush();
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        NullBuffer null;
+        cout.rdbuf(&null);
+        f();
+        ::_exit(0);
+    }
+    int status = 0;
+    return pid > 0 && ::waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+inline string readFile(const string& path)
+{
+    ifstream in(path, ios::binary);
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}